@@ -0,0 +1,153 @@
+#include "bench_utilities.h"
+#include "list_utilities.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Timing every operation would mostly measure the clock, so only every
+// LATENCY_SAMPLE_INTERVAL-th one is timed on its own.
+#define LATENCY_SAMPLE_INTERVAL 16
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+int hardware_thread_count() {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+uint64_t now_nanoseconds() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Peak resident set size of the whole process so far.
+size_t peak_rss_kilobytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return (size_t)(counters.PeakWorkingSetSize / 1024);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(__APPLE__)
+    return (size_t)usage.ru_maxrss / 1024;
+#else
+    return (size_t)usage.ru_maxrss;
+#endif
+#endif
+}
+
+uint64_t next_random(uint64_t* state) {
+    // splitmix64
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+double next_random_unit(uint64_t* state) {
+    return (double)(next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void initialize_latency_recorder(LatencyRecorder* recorder, size_t expected_samples) {
+    assert(recorder != NULL);
+    memset(recorder, 0, sizeof(LatencyRecorder));
+    increase_list_capacity((void**)&recorder->samples, &recorder->capacity, sizeof(uint64_t), expected_samples > 0 ? expected_samples : 1);
+}
+
+void destroy_latency_recorder(LatencyRecorder* recorder) {
+    assert(recorder != NULL);
+    free(recorder->samples);
+    memset(recorder, 0, sizeof(LatencyRecorder));
+}
+
+void latency_recorder_add(LatencyRecorder* recorder, uint64_t nanoseconds) {
+    if (recorder->count == recorder->capacity)
+        increase_list_capacity((void**)&recorder->samples, &recorder->capacity, sizeof(uint64_t), recorder->capacity);
+    recorder->samples[recorder->count++] = nanoseconds;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+uint64_t latency_recorder_percentile(LatencyRecorder* recorder, double percentile) {
+    if (recorder->count == 0)
+        return 0;
+
+    // Sorting in place is fine, percentiles are only read at the end of a run.
+    qsort(recorder->samples, recorder->count, sizeof(uint64_t), compare_u64);
+    size_t index = (size_t)(percentile / 100.0 * (double)(recorder->count - 1) + 0.5);
+    return recorder->samples[index];
+}
+
+void print_bench_result(const BenchResult* result) {
+    double ops_per_second = result->seconds > 0.0 ? (double)result->ops / result->seconds : 0.0;
+    printf("{\"benchmark\":\"%s\",\"workload\":\"%s\",\"variant\":\"%s\",\"size\":%zu,\"ops\":%zu,\"seconds\":%.6f,\"ops_per_sec\":%.0f",
+        result->benchmark,
+        result->workload,
+        result->variant,
+        result->size,
+        result->ops,
+        result->seconds,
+        ops_per_second);
+
+    printf(",\"results\":%zu", result->results);
+    if (result->latencies != NULL) {
+        LatencyRecorder* latencies = result->latencies;
+        printf(",\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu",
+            (unsigned long long)latency_recorder_percentile(latencies, 50.0),
+            (unsigned long long)latency_recorder_percentile(latencies, 90.0),
+            (unsigned long long)latency_recorder_percentile(latencies, 99.0),
+            (unsigned long long)latency_recorder_percentile(latencies, 99.9),
+            (unsigned long long)latency_recorder_percentile(latencies, 100.0));
+    }
+    printf(",\"peak_rss_kb\":%zu}\n", peak_rss_kilobytes());
+    fflush(stdout);
+}
+
+void run_bench_operations(BenchResult* result, BenchOperation operation, void* context) {
+    LatencyRecorder latencies;
+    initialize_latency_recorder(&latencies, result->ops / LATENCY_SAMPLE_INTERVAL + 1);
+
+    uint64_t start = now_nanoseconds();
+    for (size_t i = 0; i < result->ops; i++) {
+        if (i % LATENCY_SAMPLE_INTERVAL != 0) {
+            result->results += operation(context, i);
+            continue;
+        }
+
+        uint64_t op_start = now_nanoseconds();
+        result->results += operation(context, i);
+        latency_recorder_add(&latencies, now_nanoseconds() - op_start);
+    }
+    result->seconds = (double)(now_nanoseconds() - start) * 1e-9;
+
+    result->latencies = &latencies;
+    print_bench_result(result);
+    result->latencies = NULL;
+    destroy_latency_recorder(&latencies);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct LatencyRecorder {
+    uint64_t* samples;
+    size_t count;
+    size_t capacity;
+} LatencyRecorder;
+
+typedef struct BenchConfig {
+    size_t max_hash_table_size;
+    size_t max_quad_tree_points;
+    size_t quad_tree_queries;
+    // 0 sweeps the leaf capacities in run_quad_tree_benchmarks.
+    uint32_t quad_tree_leaf_capacity;
+    uint64_t seed;
+} BenchConfig;
+
+typedef struct BenchResult {
+    const char* benchmark;
+    const char* workload;
+    const char* variant;
+    size_t size;
+    size_t ops;
+    // Items produced by the operations, e.g. points returned by queries.
+    size_t results;
+    double seconds;
+    LatencyRecorder* latencies;
+} BenchResult;
+
+// Returns the number of items the operation produced, which is summed into
+// BenchResult.results so that runs can be checked against each other.
+typedef size_t (*BenchOperation)(void* context, size_t op_index);
+
+int hardware_thread_count();
+uint64_t now_nanoseconds();
+size_t peak_rss_kilobytes();
+
+uint64_t next_random(uint64_t* state);
+double next_random_unit(uint64_t* state);
+
+void initialize_latency_recorder(LatencyRecorder* recorder, size_t expected_samples);
+void destroy_latency_recorder(LatencyRecorder* recorder);
+void latency_recorder_add(LatencyRecorder* recorder, uint64_t nanoseconds);
+uint64_t latency_recorder_percentile(LatencyRecorder* recorder, double percentile);
+
+void print_bench_result(const BenchResult* result);
+void run_bench_operations(BenchResult* result, BenchOperation operation, void* context);
+
+void run_hash_table_benchmarks(const BenchConfig* config);
+void run_quad_tree_benchmarks(const BenchConfig* config);
@@ -0,0 +1,142 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include "bench_utilities.h"
+#include "concurrent_hash_table.h"
+#include "hash_table.h"
+
+#define PREFILLED_KEYS         (1u << 20)
+#define DEFAULT_OPS_PER_THREAD 2000000
+#define READ_PERCENT           90
+
+typedef enum BenchMode {
+    BENCH_MODE_GLOBAL_MUTEX,
+    BENCH_MODE_SEGMENTED,
+} BenchMode;
+
+typedef struct BenchContext {
+    BenchMode mode;
+    ConcurrentHashTable* concurrent_table;
+    HashTable* table;
+    mtx_t* table_lock;
+    uint64_t rng_state;
+    size_t ops;
+} BenchContext;
+
+static int bench_worker(void* arg) {
+    BenchContext* context = (BenchContext*)arg;
+    for (size_t i = 0; i < context->ops; i++) {
+        uint64_t r = next_random(&context->rng_state);
+        uint64_t key = (r >> 8) % (PREFILLED_KEYS * 2);
+        unsigned op = (unsigned)(r % 100);
+
+        if (context->mode == BENCH_MODE_SEGMENTED) {
+            if (op < READ_PERCENT) {
+                uint32_t value;
+                concurrent_hash_table_get_entry(context->concurrent_table, key, &value);
+            }
+            else if (op < READ_PERCENT + (100 - READ_PERCENT) / 2) {
+                concurrent_hash_table_insert(context->concurrent_table, key, (uint32_t)key);
+            }
+            else if (concurrent_hash_table_contains_key(context->concurrent_table, key)) {
+                concurrent_hash_table_delete_entry(context->concurrent_table, key);
+            }
+        }
+        else {
+            mtx_lock(context->table_lock);
+            if (op < READ_PERCENT) {
+                hash_table_get_entry(context->table, key);
+            }
+            else if (op < READ_PERCENT + (100 - READ_PERCENT) / 2) {
+                hash_table_insert(context->table, key, (uint32_t)key);
+            }
+            else if (hash_table_contains_key(context->table, key)) {
+                hash_table_delete_entry(context->table, key);
+            }
+            mtx_unlock(context->table_lock);
+        }
+    }
+    return 0;
+}
+
+static double run_bench(BenchMode mode, int thread_count, size_t ops_per_thread) {
+    ConcurrentHashTable concurrent_table = {0};
+    HashTable table = {0};
+    mtx_t table_lock;
+
+    if (mode == BENCH_MODE_SEGMENTED) {
+        initialize_concurrent_hash_table(&concurrent_table, 0);
+        for (uint64_t key = 0; key < PREFILLED_KEYS; key++) {
+            concurrent_hash_table_insert(&concurrent_table, key * 2, (uint32_t)key);
+        }
+    }
+    else {
+        initialize_hash_table(&table);
+        mtx_init(&table_lock, mtx_plain);
+        for (uint64_t key = 0; key < PREFILLED_KEYS; key++) {
+            hash_table_insert(&table, key * 2, (uint32_t)key);
+        }
+    }
+
+    thrd_t* threads = (thrd_t*)calloc((size_t)thread_count, sizeof(thrd_t));
+    BenchContext* contexts = (BenchContext*)calloc((size_t)thread_count, sizeof(BenchContext));
+    assert(threads != NULL && contexts != NULL);
+
+    uint64_t start = now_nanoseconds();
+    for (int i = 0; i < thread_count; i++) {
+        contexts[i] = (BenchContext){
+            .mode = mode,
+            .concurrent_table = &concurrent_table,
+            .table = &table,
+            .table_lock = &table_lock,
+            .rng_state = 0x9E3779B97F4A7C15ull * (uint64_t)(i + 1),
+            .ops = ops_per_thread,
+        };
+        thrd_create(&threads[i], bench_worker, &contexts[i]);
+    }
+    for (int i = 0; i < thread_count; i++) {
+        thrd_join(threads[i], NULL);
+    }
+    double elapsed = (double)(now_nanoseconds() - start) * 1e-9;
+
+    free(contexts);
+    free(threads);
+    if (mode == BENCH_MODE_SEGMENTED) {
+        destroy_concurrent_hash_table(&concurrent_table);
+    }
+    else {
+        destroy_hash_table(&table);
+        mtx_destroy(&table_lock);
+    }
+    return (double)ops_per_thread * (double)thread_count / elapsed;
+}
+
+// Usage: concurrent_hash_table_bench [max_threads] [ops_per_thread]
+// Prints one JSON object per line.
+int main(int argc, char** argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : hardware_thread_count();
+    size_t ops_per_thread = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : DEFAULT_OPS_PER_THREAD;
+    if (max_threads < 1)
+        max_threads = 1;
+
+    static const char* mode_names[] = {"global_mutex", "segmented"};
+    for (int mode = BENCH_MODE_GLOBAL_MUTEX; mode <= BENCH_MODE_SEGMENTED; mode++) {
+        for (int threads = 1;; threads *= 2) {
+            if (threads > max_threads)
+                threads = max_threads;
+
+            double ops_per_second = run_bench((BenchMode)mode, threads, ops_per_thread);
+            printf("{\"benchmark\":\"concurrent_hash_table\",\"mode\":\"%s\",\"threads\":%d,\"read_percent\":%d,\"ops_per_sec\":%.0f}\n", mode_names[mode], threads, READ_PERCENT, ops_per_second);
+            fflush(stdout);
+
+            if (threads == max_threads)
+                break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,202 @@
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+
+#include "bench_utilities.h"
+#include "concurrent_quad_tree.h"
+#include "quad_tree.h"
+
+#define WORLD_HALF_SIZE         1000.0f
+#define PREFILLED_POINTS        100000
+#define CHURN_POINTS_PER_WRITER 1000
+#define QUERY_HALF_SIZE         30.0f
+#define MAX_FOUND               4096
+#define DEFAULT_MILLISECONDS    1000
+
+typedef enum BenchMode {
+    BENCH_MODE_GLOBAL_MUTEX,
+    BENCH_MODE_GRID,
+} BenchMode;
+
+typedef struct BenchContext {
+    BenchMode mode;
+    ConcurrentQuadTree* concurrent_tree;
+    QuadTree* tree;
+    mtx_t* tree_lock;
+    atomic_bool* stop;
+    uint64_t rng_state;
+    size_t ops;
+} BenchContext;
+
+static Point random_point(uint64_t* rng_state) {
+    return (Point){
+        .x = (float)(next_random_unit(rng_state) * 2.0 - 1.0) * WORLD_HALF_SIZE,
+        .y = (float)(next_random_unit(rng_state) * 2.0 - 1.0) * WORLD_HALF_SIZE,
+    };
+}
+
+// Inserts its own points and removes them again, so subdivisions and
+// collapses keep happening under the readers.
+static int bench_writer(void* arg) {
+    BenchContext* context = (BenchContext*)arg;
+    Point points[CHURN_POINTS_PER_WRITER];
+    for (size_t i = 0; i < CHURN_POINTS_PER_WRITER; i++) {
+        points[i] = random_point(&context->rng_state);
+    }
+
+    // Counted locally, since the contexts share cache lines.
+    size_t ops = 0;
+    while (!atomic_load_explicit(context->stop, memory_order_relaxed)) {
+        size_t phase = ops % (2 * CHURN_POINTS_PER_WRITER);
+        Point point = points[phase % CHURN_POINTS_PER_WRITER];
+        bool inserting = phase < CHURN_POINTS_PER_WRITER;
+        if (context->mode == BENCH_MODE_GRID) {
+            if (inserting)
+                concurrent_quad_tree_insert_point(context->concurrent_tree, point);
+            else
+                concurrent_quad_tree_remove_point(context->concurrent_tree, point);
+        }
+        else {
+            mtx_lock(context->tree_lock);
+            if (inserting)
+                insert_point_into_quadtree(context->tree, point);
+            else
+                remove_point_from_quad_tree(context->tree, point);
+            mtx_unlock(context->tree_lock);
+        }
+        ++ops;
+    }
+    context->ops = ops;
+    return 0;
+}
+
+static int bench_reader(void* arg) {
+    BenchContext* context = (BenchContext*)arg;
+    Point* found = (Point*)malloc(MAX_FOUND * sizeof(Point));
+    assert(found != NULL);
+
+    size_t ops = 0;
+    while (!atomic_load_explicit(context->stop, memory_order_relaxed)) {
+        Point center = random_point(&context->rng_state);
+        Rect range = create_rect(center.x, center.y, QUERY_HALF_SIZE, QUERY_HALF_SIZE);
+        int found_count = 0;
+        if (context->mode == BENCH_MODE_GRID) {
+            concurrent_quad_tree_search_rect(context->concurrent_tree, range, found, &found_count, MAX_FOUND);
+        }
+        else {
+            mtx_lock(context->tree_lock);
+            search_space_in_tree(context->tree, range, found, &found_count, MAX_FOUND);
+            mtx_unlock(context->tree_lock);
+        }
+        ++ops;
+    }
+    context->ops = ops;
+    free(found);
+    return 0;
+}
+
+static void run_bench(BenchMode mode, int reader_count, int writer_count, long milliseconds, double* reads_per_second, double* writes_per_second) {
+    Rect bounds = create_rect(0.0f, 0.0f, WORLD_HALF_SIZE, WORLD_HALF_SIZE);
+    ConcurrentQuadTree concurrent_tree = {0};
+    QuadTree* tree = NULL;
+    mtx_t tree_lock;
+    atomic_bool stop;
+    atomic_init(&stop, false);
+
+    uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+    if (mode == BENCH_MODE_GRID) {
+        initialize_concurrent_quad_tree(&concurrent_tree, bounds, 0);
+        for (size_t i = 0; i < PREFILLED_POINTS; i++) {
+            concurrent_quad_tree_insert_point(&concurrent_tree, random_point(&rng_state));
+        }
+    }
+    else {
+        tree = create_new_tree(bounds);
+        mtx_init(&tree_lock, mtx_plain);
+        for (size_t i = 0; i < PREFILLED_POINTS; i++) {
+            insert_point_into_quadtree(tree, random_point(&rng_state));
+        }
+    }
+
+    int thread_count = reader_count + writer_count;
+    thrd_t* threads = (thrd_t*)calloc((size_t)thread_count, sizeof(thrd_t));
+    BenchContext* contexts = (BenchContext*)calloc((size_t)thread_count, sizeof(BenchContext));
+    assert(threads != NULL && contexts != NULL);
+
+    uint64_t start = now_nanoseconds();
+    for (int i = 0; i < thread_count; i++) {
+        contexts[i] = (BenchContext){
+            .mode = mode,
+            .concurrent_tree = &concurrent_tree,
+            .tree = tree,
+            .tree_lock = &tree_lock,
+            .stop = &stop,
+            .rng_state = 0x9E3779B97F4A7C15ull * (uint64_t)(i + 2),
+        };
+        thrd_create(&threads[i], i < writer_count ? bench_writer : bench_reader, &contexts[i]);
+    }
+    struct timespec duration = {.tv_sec = milliseconds / 1000, .tv_nsec = (milliseconds % 1000) * 1000000};
+    thrd_sleep(&duration, NULL);
+    atomic_store(&stop, true);
+    for (int i = 0; i < thread_count; i++) {
+        thrd_join(threads[i], NULL);
+    }
+    double elapsed = (double)(now_nanoseconds() - start) * 1e-9;
+
+    size_t reads = 0;
+    size_t writes = 0;
+    for (int i = 0; i < thread_count; i++) {
+        if (i < writer_count)
+            writes += contexts[i].ops;
+        else
+            reads += contexts[i].ops;
+    }
+    *reads_per_second = (double)reads / elapsed;
+    *writes_per_second = (double)writes / elapsed;
+
+    free(contexts);
+    free(threads);
+    if (mode == BENCH_MODE_GRID) {
+        destroy_concurrent_quad_tree(&concurrent_tree);
+    }
+    else {
+        free_quad_tree(tree);
+        mtx_destroy(&tree_lock);
+    }
+}
+
+// Usage: concurrent_quad_tree_bench [max_threads] [milliseconds]
+// Runs 1 and 2 writers against a doubling number of readers. Prints one
+// JSON object per line.
+int main(int argc, char** argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : hardware_thread_count();
+    long milliseconds = argc > 2 ? atol(argv[2]) : DEFAULT_MILLISECONDS;
+    if (max_threads < 1)
+        max_threads = 1;
+
+    static const char* mode_names[] = {"global_mutex", "grid"};
+    for (int mode = BENCH_MODE_GLOBAL_MUTEX; mode <= BENCH_MODE_GRID; mode++) {
+        for (int writers = 1; writers <= 2; writers++) {
+            for (int readers = 1;; readers *= 2) {
+                if (readers > max_threads)
+                    readers = max_threads;
+
+                double reads_per_second;
+                double writes_per_second;
+                run_bench((BenchMode)mode, readers, writers, milliseconds, &reads_per_second, &writes_per_second);
+                printf("{\"benchmark\":\"concurrent_quad_tree\",\"mode\":\"%s\",\"readers\":%d,\"writers\":%d,\"reads_per_sec\":%.0f,\"writes_per_sec\":%.0f}\n", mode_names[mode], readers, writers, reads_per_second, writes_per_second);
+                fflush(stdout);
+
+                if (readers == max_threads)
+                    break;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "bench_utilities.h"
+#include "hash_table.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define HOT_KEY_PERCENT 10
+#define HOT_OP_PERCENT  90
+
+typedef struct HashTableBenchContext {
+    HashTable* table;
+    uint64_t* keys;
+    const uint64_t* missing_keys;
+    size_t key_count;
+    unsigned read_percent;
+    uint64_t rng_state;
+} HashTableBenchContext;
+
+static const char* probing_name(HashTableProbing probing) {
+    return probing == HASH_TABLE_PROBING_GROUP ? "group" : "robin_hood";
+}
+
+// Present keys have the low bit clear and missing keys have it set, so the
+// two sets never overlap.
+static uint64_t* generate_keys(size_t count, uint64_t* rng_state, uint64_t low_bit) {
+    uint64_t* keys = (uint64_t*)malloc(count * sizeof(uint64_t));
+    assert(keys != NULL);
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = (next_random(rng_state) & ~(uint64_t)1) | low_bit;
+    }
+    return keys;
+}
+
+static size_t uniform_index(HashTableBenchContext* context) {
+    return (size_t)(next_random(&context->rng_state) % context->key_count);
+}
+
+// 90% of operations go to the first 10% of the keys.
+static size_t skewed_index(HashTableBenchContext* context) {
+    uint64_t r = next_random(&context->rng_state);
+    size_t hot_count = context->key_count * HOT_KEY_PERCENT / 100;
+    if (hot_count > 0 && (r % 100) < HOT_OP_PERCENT)
+        return (size_t)((r >> 8) % hot_count);
+    return (size_t)((r >> 8) % context->key_count);
+}
+
+static size_t insert_operation(void* arg, size_t op_index) {
+    HashTableBenchContext* context = (HashTableBenchContext*)arg;
+    return hash_table_insert(context->table, context->keys[op_index], (uint32_t)op_index);
+}
+
+static size_t lookup_hit_operation(void* arg, size_t op_index) {
+    HashTableBenchContext* context = (HashTableBenchContext*)arg;
+    (void)op_index;
+    return hash_table_get_entry(context->table, context->keys[uniform_index(context)]) != NULL;
+}
+
+static size_t lookup_skewed_operation(void* arg, size_t op_index) {
+    HashTableBenchContext* context = (HashTableBenchContext*)arg;
+    (void)op_index;
+    return hash_table_get_entry(context->table, context->keys[skewed_index(context)]) != NULL;
+}
+
+static size_t lookup_miss_operation(void* arg, size_t op_index) {
+    HashTableBenchContext* context = (HashTableBenchContext*)arg;
+    (void)op_index;
+    return hash_table_contains_key(context->table, context->missing_keys[uniform_index(context)]);
+}
+
+static size_t mixed_operation(void* arg, size_t op_index) {
+    HashTableBenchContext* context = (HashTableBenchContext*)arg;
+    size_t index = uniform_index(context);
+    if ((next_random(&context->rng_state) % 100) < context->read_percent)
+        return hash_table_get_entry(context->table, context->keys[index]) != NULL;
+    return hash_table_insert(context->table, context->keys[index], (uint32_t)op_index);
+}
+
+// Deletes a present key and inserts a new one in its place, so the table
+// size stays constant while slots keep getting freed and reused.
+static size_t delete_churn_operation(void* arg, size_t op_index) {
+    HashTableBenchContext* context = (HashTableBenchContext*)arg;
+    size_t index = uniform_index(context);
+    hash_table_delete_entry(context->table, context->keys[index]);
+    context->keys[index] = next_random(&context->rng_state) & ~(uint64_t)1;
+    return hash_table_insert(context->table, context->keys[index], (uint32_t)op_index);
+}
+
+static void run_hash_table_workload(HashTableBenchContext* context, const char* workload, HashTableProbing probing, BenchOperation operation) {
+    BenchResult result = {
+        .benchmark = "hash_table",
+        .workload = workload,
+        .variant = probing_name(probing),
+        .size = context->key_count,
+        .ops = context->key_count,
+    };
+    run_bench_operations(&result, operation, context);
+}
+
+// Whole-table build, so there is no per-operation latency to report.
+static void run_build_from_arrays(const uint64_t* keys, size_t size, HashTableProbing probing) {
+    uint32_t* values = (uint32_t*)malloc(size * sizeof(uint32_t));
+    assert(values != NULL);
+    for (size_t i = 0; i < size; i++) {
+        values[i] = (uint32_t)i;
+    }
+
+    HashTable table;
+    initialize_hash_table_with_probing(&table, probing);
+
+    uint64_t start = now_nanoseconds();
+    hash_table_build_from_arrays(&table, keys, values, size);
+    BenchResult result = {
+        .benchmark = "hash_table",
+        .workload = "build_from_arrays",
+        .variant = probing_name(probing),
+        .size = size,
+        .ops = size,
+        .results = table.count,
+        .seconds = (double)(now_nanoseconds() - start) * 1e-9,
+    };
+    print_bench_result(&result);
+
+    destroy_hash_table(&table);
+    free(values);
+}
+
+static void run_hash_table_size(const BenchConfig* config, size_t size, HashTableProbing probing) {
+    uint64_t rng_state = config->seed ^ (uint64_t)size;
+    uint64_t* keys = generate_keys(size, &rng_state, 0);
+    uint64_t* missing_keys = generate_keys(size, &rng_state, 1);
+
+    HashTable table;
+    initialize_hash_table_with_probing(&table, probing);
+
+    HashTableBenchContext context = {
+        .table = &table,
+        .keys = keys,
+        .missing_keys = missing_keys,
+        .key_count = size,
+        .rng_state = rng_state,
+    };
+
+    run_build_from_arrays(keys, size, probing);
+    run_hash_table_workload(&context, "insert_uniform", probing, insert_operation);
+    run_hash_table_workload(&context, "lookup_hit_uniform", probing, lookup_hit_operation);
+    run_hash_table_workload(&context, "lookup_hit_skewed", probing, lookup_skewed_operation);
+    run_hash_table_workload(&context, "lookup_miss_uniform", probing, lookup_miss_operation);
+
+    static const unsigned read_percents[] = {50, 90, 99};
+    static const char* mixed_names[] = {"mixed_read50", "mixed_read90", "mixed_read99"};
+    for (size_t i = 0; i < sizeof(read_percents) / sizeof(read_percents[0]); i++) {
+        context.read_percent = read_percents[i];
+        run_hash_table_workload(&context, mixed_names[i], probing, mixed_operation);
+    }
+
+    run_hash_table_workload(&context, "delete_churn", probing, delete_churn_operation);
+
+    destroy_hash_table(&table);
+    free(missing_keys);
+    free(keys);
+}
+
+void run_hash_table_benchmarks(const BenchConfig* config) {
+    for (size_t size = 1000; size <= config->max_hash_table_size; size *= 10) {
+        run_hash_table_size(config, size, HASH_TABLE_PROBING_ROBIN_HOOD);
+        run_hash_table_size(config, size, HASH_TABLE_PROBING_GROUP);
+    }
+}
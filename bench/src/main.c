@@ -0,0 +1,78 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_utilities.h"
+#include "quad_tree.h"
+
+#define DEFAULT_MAX_HASH_TABLE_SIZE  1000000
+#define DEFAULT_MAX_QUAD_TREE_POINTS 1000000
+#define DEFAULT_QUAD_TREE_QUERIES    10000
+#define DEFAULT_SEED                 0x5EED5EED5EED5EEDull
+
+static void print_usage(const char* program) {
+    fprintf(stderr,
+        "Usage: %s [--only hash_table|quad_tree] [--max-hash-table-size N]\n"
+        "       [--max-quad-tree-points N] [--queries N] [--seed N]\n"
+        "       [--quad-tree-leaf-capacity N, 0 to sweep]\n"
+        "Prints one JSON object per line.\n",
+        program);
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = {
+        .max_hash_table_size = DEFAULT_MAX_HASH_TABLE_SIZE,
+        .max_quad_tree_points = DEFAULT_MAX_QUAD_TREE_POINTS,
+        .quad_tree_queries = DEFAULT_QUAD_TREE_QUERIES,
+        .quad_tree_leaf_capacity = QUAD_TREE_DEFAULT_LEAF_CAPACITY,
+        .seed = DEFAULT_SEED,
+    };
+    bool run_hash_table = true;
+    bool run_quad_tree = true;
+
+    for (int i = 1; i < argc; i++) {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (value == NULL) {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        if (strcmp(argv[i], "--max-hash-table-size") == 0) {
+            config.max_hash_table_size = (size_t)strtoull(value, NULL, 10);
+        }
+        else if (strcmp(argv[i], "--max-quad-tree-points") == 0) {
+            config.max_quad_tree_points = (size_t)strtoull(value, NULL, 10);
+        }
+        else if (strcmp(argv[i], "--queries") == 0) {
+            config.quad_tree_queries = (size_t)strtoull(value, NULL, 10);
+        }
+        else if (strcmp(argv[i], "--quad-tree-leaf-capacity") == 0) {
+            config.quad_tree_leaf_capacity = (uint32_t)strtoul(value, NULL, 10);
+        }
+        else if (strcmp(argv[i], "--seed") == 0) {
+            config.seed = strtoull(value, NULL, 0);
+        }
+        else if (strcmp(argv[i], "--only") == 0) {
+            run_hash_table = strcmp(value, "hash_table") == 0;
+            run_quad_tree = strcmp(value, "quad_tree") == 0;
+            if (!run_hash_table && !run_quad_tree) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+
+    if (run_hash_table)
+        run_hash_table_benchmarks(&config);
+    if (run_quad_tree)
+        run_quad_tree_benchmarks(&config);
+    return 0;
+}
@@ -0,0 +1,601 @@
+#include "bench_utilities.h"
+#include "loose_quad_tree.h"
+#include "quad_tree.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WORLD_HALF_SIZE   1000.0f
+#define CLUSTER_COUNT     32
+#define CLUSTER_DEVIATION 10.0f
+#define PI                3.14159265358979f
+#define MOVE_DISTANCE     1.0f
+#define BOX_HALF_SIZE     2.0f
+#define JOIN_RADIUS       2.0f
+#define SNAPSHOT_PATH     "quad_tree_bench.snapshot"
+
+typedef enum PointDistribution {
+    POINT_DISTRIBUTION_UNIFORM,
+    POINT_DISTRIBUTION_CLUSTERED,
+} PointDistribution;
+
+typedef struct QuadTreeBenchContext {
+    QuadTree* tree;
+    const Point* points;
+    size_t point_count;
+    // Fraction of the world area covered by each query.
+    double selectivity;
+    Point* found;
+    int max_found;
+    int k;
+    // Current positions of moving points, indexed by id.
+    Point* positions;
+    uint64_t rng_state;
+} QuadTreeBenchContext;
+
+static float clamp_to_world(float value) {
+    return fmaxf(-WORLD_HALF_SIZE, fminf(WORLD_HALF_SIZE, value));
+}
+
+static Point* generate_points(size_t count, PointDistribution distribution, uint64_t* rng_state) {
+    Point* points = (Point*)malloc(count * sizeof(Point));
+    assert(points != NULL);
+
+    Point centers[CLUSTER_COUNT];
+    for (int i = 0; i < CLUSTER_COUNT; i++) {
+        centers[i].x = (float)(next_random_unit(rng_state) * 2.0 - 1.0) * WORLD_HALF_SIZE;
+        centers[i].y = (float)(next_random_unit(rng_state) * 2.0 - 1.0) * WORLD_HALF_SIZE;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (distribution == POINT_DISTRIBUTION_UNIFORM) {
+            points[i].x = (float)(next_random_unit(rng_state) * 2.0 - 1.0) * WORLD_HALF_SIZE;
+            points[i].y = (float)(next_random_unit(rng_state) * 2.0 - 1.0) * WORLD_HALF_SIZE;
+            continue;
+        }
+
+        // Box-Muller around a random cluster center.
+        Point center = centers[next_random(rng_state) % CLUSTER_COUNT];
+        double u1 = next_random_unit(rng_state) + 1e-12;
+        double u2 = next_random_unit(rng_state);
+        double radius = sqrt(-2.0 * log(u1)) * CLUSTER_DEVIATION;
+        points[i].x = clamp_to_world(center.x + (float)(radius * cos(2.0 * PI * u2)));
+        points[i].y = clamp_to_world(center.y + (float)(radius * sin(2.0 * PI * u2)));
+    }
+    return points;
+}
+
+// Queries are centered on data points so that clustered data is actually
+// hit instead of mostly querying empty space.
+static Point query_center(QuadTreeBenchContext* context) {
+    return context->points[next_random(&context->rng_state) % context->point_count];
+}
+
+static size_t insert_operation(void* arg, size_t op_index) {
+    QuadTreeBenchContext* context = (QuadTreeBenchContext*)arg;
+    return insert_point_into_quadtree(context->tree, context->points[op_index]);
+}
+
+static size_t rect_query_operation(void* arg, size_t op_index) {
+    QuadTreeBenchContext* context = (QuadTreeBenchContext*)arg;
+    (void)op_index;
+    float half_size = (float)(sqrt(context->selectivity) * WORLD_HALF_SIZE);
+    Point center = query_center(context);
+    int found_count = 0;
+    search_space_in_tree(context->tree, create_rect(center.x, center.y, half_size, half_size), context->found, &found_count, context->max_found);
+    return (size_t)found_count;
+}
+
+static size_t circle_query_operation(void* arg, size_t op_index) {
+    QuadTreeBenchContext* context = (QuadTreeBenchContext*)arg;
+    (void)op_index;
+    double world_area = 4.0 * WORLD_HALF_SIZE * WORLD_HALF_SIZE;
+    Circle circle = {
+        .center = query_center(context),
+        .radius = (float)sqrt(context->selectivity * world_area / PI),
+    };
+    int found_count = 0;
+    search_circle_in_tree(context->tree, circle, context->found, &found_count, context->max_found);
+    return (size_t)found_count;
+}
+
+static size_t rect_count_operation(void* arg, size_t op_index) {
+    QuadTreeBenchContext* context = (QuadTreeBenchContext*)arg;
+    (void)op_index;
+    float half_size = (float)(sqrt(context->selectivity) * WORLD_HALF_SIZE);
+    Point center = query_center(context);
+    return quad_tree_count_in_rect(context->tree, create_rect(center.x, center.y, half_size, half_size));
+}
+
+static bool count_visited_point(Point point, uint64_t id, void* context) {
+    (void)point;
+    (void)id;
+    ++*(size_t*)context;
+    return true;
+}
+
+static size_t rect_each_operation(void* arg, size_t op_index) {
+    QuadTreeBenchContext* context = (QuadTreeBenchContext*)arg;
+    (void)op_index;
+    float half_size = (float)(sqrt(context->selectivity) * WORLD_HALF_SIZE);
+    Point center = query_center(context);
+    size_t visited = 0;
+    quad_tree_query_rect_each(context->tree, create_rect(center.x, center.y, half_size, half_size), count_visited_point, &visited);
+    return visited;
+}
+
+static size_t knn_operation(void* arg, size_t op_index) {
+    QuadTreeBenchContext* context = (QuadTreeBenchContext*)arg;
+    (void)op_index;
+    Point point = {
+        .x = (float)(next_random_unit(&context->rng_state) * 2.0 - 1.0) * WORLD_HALF_SIZE,
+        .y = (float)(next_random_unit(&context->rng_state) * 2.0 - 1.0) * WORLD_HALF_SIZE,
+    };
+    return (size_t)quad_tree_knn(context->tree, point, context->k, context->found);
+}
+
+// Small per-tick step, so most moves stay within their leaf.
+static Point step_position(QuadTreeBenchContext* context, Point position) {
+    position.x = clamp_to_world(position.x + (float)(next_random_unit(&context->rng_state) * 2.0 - 1.0) * MOVE_DISTANCE);
+    position.y = clamp_to_world(position.y + (float)(next_random_unit(&context->rng_state) * 2.0 - 1.0) * MOVE_DISTANCE);
+    return position;
+}
+
+static size_t move_operation(void* arg, size_t op_index) {
+    QuadTreeBenchContext* context = (QuadTreeBenchContext*)arg;
+    size_t id = op_index % context->point_count;
+    Point position = step_position(context, context->positions[id]);
+    if (!quad_tree_move(context->tree, id, position))
+        return 0;
+    context->positions[id] = position;
+    return 1;
+}
+
+// What moving a point cost before ids: remove by position and re-insert.
+static size_t remove_insert_operation(void* arg, size_t op_index) {
+    QuadTreeBenchContext* context = (QuadTreeBenchContext*)arg;
+    size_t id = op_index % context->point_count;
+    Point position = step_position(context, context->positions[id]);
+    if (!remove_point_from_quad_tree(context->tree, context->positions[id]))
+        return 0;
+    if (!insert_point_into_quadtree(context->tree, position)) {
+        insert_point_into_quadtree(context->tree, context->positions[id]);
+        return 0;
+    }
+    context->positions[id] = position;
+    return 1;
+}
+
+static void run_moves(const BenchConfig* config, const Point* points, size_t size, uint32_t leaf_capacity, const char* variant) {
+    Point* positions = (Point*)malloc(size * sizeof(Point));
+    assert(positions != NULL);
+    Rect bounds = create_rect(0.0f, 0.0f, WORLD_HALF_SIZE, WORLD_HALF_SIZE);
+
+    QuadTreeBenchContext context = {
+        .tree = create_new_tree_with_leaf_capacity(bounds, leaf_capacity),
+        .points = points,
+        .point_count = size,
+        .positions = positions,
+        .rng_state = config->seed ^ (uint64_t)size,
+    };
+    for (size_t i = 0; i < size; i++) {
+        positions[i] = points[i];
+        quad_tree_insert_with_id(context.tree, points[i], i);
+    }
+
+    BenchResult move_result = {
+        .benchmark = "quad_tree",
+        .workload = "move",
+        .variant = variant,
+        .size = size,
+        .ops = size,
+    };
+    run_bench_operations(&move_result, move_operation, &context);
+
+    uint64_t start = now_nanoseconds();
+    quad_tree_rebalance(context.tree);
+    BenchResult rebalance_result = {
+        .benchmark = "quad_tree",
+        .workload = "rebalance",
+        .variant = variant,
+        .size = size,
+        .ops = 1,
+        .seconds = (double)(now_nanoseconds() - start) * 1e-9,
+    };
+    print_bench_result(&rebalance_result);
+    free_quad_tree(context.tree);
+
+    context.tree = create_new_tree_with_leaf_capacity(bounds, leaf_capacity);
+    for (size_t i = 0; i < size; i++) {
+        positions[i] = points[i];
+        insert_point_into_quadtree(context.tree, points[i]);
+    }
+
+    BenchResult remove_insert_result = {
+        .benchmark = "quad_tree",
+        .workload = "move_remove_insert",
+        .variant = variant,
+        .size = size,
+        .ops = size,
+    };
+    run_bench_operations(&remove_insert_result, remove_insert_operation, &context);
+
+    free_quad_tree(context.tree);
+    free(positions);
+}
+
+// One batch of rect queries per thread count, timed as a whole like the bulk
+// build. Single-threaded runs are the baseline for the parallel ones.
+static void run_batch_queries(const BenchConfig* config, QuadTreeBenchContext* context, const char* variant) {
+    float half_size = (float)(sqrt(context->selectivity) * WORLD_HALF_SIZE);
+    QuadTreeQuery* queries = (QuadTreeQuery*)malloc(config->quad_tree_queries * sizeof(QuadTreeQuery));
+    assert(queries != NULL);
+    for (size_t i = 0; i < config->quad_tree_queries; i++) {
+        Point center = query_center(context);
+        queries[i] = (QuadTreeQuery){
+            .shape = QUAD_TREE_QUERY_RECT,
+            .rect = create_rect(center.x, center.y, half_size, half_size),
+        };
+    }
+
+    quad_tree_freeze(context->tree);
+    size_t thread_counts[] = {1, (size_t)hardware_thread_count()};
+    static const char* workload_names[] = {"rect_batch_1pct_1thread", "rect_batch_1pct_all_threads"};
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+        QuadTreeBatchResults batch;
+        uint64_t start = now_nanoseconds();
+        quad_tree_query_batch(context->tree, queries, config->quad_tree_queries, &batch, thread_counts[i]);
+        double seconds = (double)(now_nanoseconds() - start) * 1e-9;
+
+        BenchResult result = {
+            .benchmark = "quad_tree",
+            .workload = workload_names[i],
+            .variant = variant,
+            .size = context->point_count,
+            .ops = config->quad_tree_queries,
+            .seconds = seconds,
+        };
+        for (size_t q = 0; q < batch.span_count; q++) {
+            result.results += batch.spans[q].count;
+        }
+        print_bench_result(&result);
+        destroy_quad_tree_batch_results(&batch);
+    }
+    quad_tree_unfreeze(context->tree);
+    free(queries);
+}
+
+// Shape of the tree after the inserts, for comparing leaf capacities.
+static void print_tree_stats(const QuadTree* tree, size_t size, const char* variant) {
+    QuadTreeStats stats;
+    quad_tree_get_stats(tree, &stats);
+    printf("{\"benchmark\":\"quad_tree\",\"workload\":\"tree_stats\",\"variant\":\"%s\",\"size\":%zu,\"nodes\":%zu,\"leaves\":%zu,\"empty_leaves\":%zu,\"overflow_leaves\":%zu,\"max_depth\":%zu,\"leaf_fill_factor\":%.3f,\"memory_bytes\":%zu}\n",
+           variant, size, stats.node_count, stats.leaf_count, stats.empty_leaf_count, stats.overflow_leaf_count, stats.max_depth, stats.leaf_fill_factor, stats.memory_bytes);
+}
+
+// Whole-tree build, so there is no per-operation latency to report.
+static void run_build_bulk(const Point* points, size_t size, uint32_t leaf_capacity, const char* variant) {
+    uint64_t start = now_nanoseconds();
+    QuadTree* tree = quad_tree_build_bulk(create_rect(0.0f, 0.0f, WORLD_HALF_SIZE, WORLD_HALF_SIZE), points, size, leaf_capacity);
+    BenchResult result = {
+        .benchmark = "quad_tree",
+        .workload = "build_bulk",
+        .variant = variant,
+        .size = size,
+        .ops = size,
+        .results = tree->nodes[0].count,
+        .seconds = (double)(now_nanoseconds() - start) * 1e-9,
+    };
+    print_bench_result(&result);
+    free_quad_tree(tree);
+}
+
+// Saves the tree, maps it back and repeats the 1% rect queries on the
+// mapped image.
+static void run_snapshot(const BenchConfig* config, QuadTreeBenchContext* context, const char* variant) {
+    uint64_t start = now_nanoseconds();
+    if (!quad_tree_save(context->tree, SNAPSHOT_PATH)) {
+        fprintf(stderr, "Could not save the quad tree to %s\n", SNAPSHOT_PATH);
+        remove(SNAPSHOT_PATH);
+        exit(1);
+    }
+    BenchResult save_result = {
+        .benchmark = "quad_tree",
+        .workload = "snapshot_save",
+        .variant = variant,
+        .size = context->point_count,
+        .ops = 1,
+        .results = context->tree->nodes[0].count,
+        .seconds = (double)(now_nanoseconds() - start) * 1e-9,
+    };
+    print_bench_result(&save_result);
+
+    start = now_nanoseconds();
+    QuadTree* mapped = quad_tree_open_mapped(SNAPSHOT_PATH);
+    if (mapped == NULL) {
+        fprintf(stderr, "Could not map the quad tree snapshot %s\n", SNAPSHOT_PATH);
+        remove(SNAPSHOT_PATH);
+        exit(1);
+    }
+    BenchResult open_result = {
+        .benchmark = "quad_tree",
+        .workload = "snapshot_open",
+        .variant = variant,
+        .size = context->point_count,
+        .ops = 1,
+        .results = mapped->nodes[0].count,
+        .seconds = (double)(now_nanoseconds() - start) * 1e-9,
+    };
+    print_bench_result(&open_result);
+
+    QuadTree* tree = context->tree;
+    context->tree = mapped;
+    BenchResult query_result = {
+        .benchmark = "quad_tree",
+        .workload = "rect_query_1pct_mapped",
+        .variant = variant,
+        .size = context->point_count,
+        .ops = config->quad_tree_queries,
+    };
+    run_bench_operations(&query_result, rect_query_operation, context);
+    context->tree = tree;
+
+    free_quad_tree(mapped);
+    remove(SNAPSHOT_PATH);
+}
+
+static bool count_point_pair(Point a, uint64_t a_id, Point b, uint64_t b_id, void* context) {
+    (void)a;
+    (void)a_id;
+    (void)b;
+    (void)b_id;
+    atomic_fetch_add_explicit((atomic_size_t*)context, 1, memory_order_relaxed);
+    return true;
+}
+
+// Every pair of points within JOIN_RADIUS, from the node-pair join on one
+// and on all threads, and from one circle query per point, which finds each
+// pair from both sides.
+static void run_distance_joins(QuadTreeBenchContext* context, const char* variant) {
+    static const char* workload_names[] = {"pairs_within_join", "pairs_within_join_all_threads"};
+    quad_tree_freeze(context->tree);
+    for (size_t i = 0; i < sizeof(workload_names) / sizeof(workload_names[0]); i++) {
+        atomic_size_t pairs;
+        atomic_init(&pairs, 0);
+        uint64_t start = now_nanoseconds();
+        if (i == 0)
+            quad_tree_pairs_within(context->tree, JOIN_RADIUS, count_point_pair, &pairs);
+        else
+            quad_tree_pairs_within_parallel(context->tree, JOIN_RADIUS, count_point_pair, &pairs, 0);
+        BenchResult result = {
+            .benchmark = "quad_tree",
+            .workload = workload_names[i],
+            .variant = variant,
+            .size = context->point_count,
+            .ops = 1,
+            .results = atomic_load(&pairs),
+            .seconds = (double)(now_nanoseconds() - start) * 1e-9,
+        };
+        print_bench_result(&result);
+    }
+    quad_tree_unfreeze(context->tree);
+
+    size_t found_total = 0;
+    uint64_t start = now_nanoseconds();
+    for (size_t i = 0; i < context->point_count; i++) {
+        Circle circle = {.center = context->points[i], .radius = JOIN_RADIUS};
+        int found_count = 0;
+        search_circle_in_tree(context->tree, circle, context->found, &found_count, context->max_found);
+        found_total += (size_t)found_count;
+    }
+    // Repeated points are not inserted, so every query also finds its own
+    // point exactly once.
+    BenchResult query_result = {
+        .benchmark = "quad_tree",
+        .workload = "pairs_within_circle_queries",
+        .variant = variant,
+        .size = context->point_count,
+        .ops = 1,
+        .results = (found_total - context->point_count) / 2,
+        .seconds = (double)(now_nanoseconds() - start) * 1e-9,
+    };
+    print_bench_result(&query_result);
+}
+
+static bool count_pair(const LooseQuadTreeEntry* a, const LooseQuadTreeEntry* b, void* context) {
+    (void)a;
+    (void)b;
+    ++*(size_t*)context;
+    return true;
+}
+
+// Broad phase over boxes centered on the points: every overlapping pair
+// from one traversal, against the query-per-box approach it replaces. The
+// loose tree has no leaf capacity, so this runs once per distribution.
+static void run_overlapping_pairs(const BenchConfig* config, size_t size, PointDistribution distribution) {
+    static const char* distribution_names[] = {"uniform", "clustered"};
+    const char* variant = distribution_names[distribution];
+    uint64_t rng_state = config->seed ^ (uint64_t)size ^ ((uint64_t)distribution << 32);
+    Point* points = generate_points(size, distribution, &rng_state);
+
+    Rect bounds = create_rect(0.0f, 0.0f, WORLD_HALF_SIZE, WORLD_HALF_SIZE);
+    Rect* boxes = (Rect*)malloc(size * sizeof(Rect));
+    uint64_t* found = (uint64_t*)malloc(size * sizeof(uint64_t));
+    assert(boxes != NULL && found != NULL);
+
+    LooseQuadTree* tree = create_new_loose_quad_tree(bounds);
+    for (size_t i = 0; i < size; i++) {
+        float half_size = (float)(next_random_unit(&rng_state) * BOX_HALF_SIZE);
+        boxes[i] = create_rect(points[i].x, points[i].y, half_size, half_size);
+        loose_quad_tree_insert(tree, boxes[i], i);
+    }
+
+    size_t pairs = 0;
+    uint64_t start = now_nanoseconds();
+    quad_tree_find_all_overlapping_pairs(tree, count_pair, &pairs);
+    BenchResult single_result = {
+        .benchmark = "quad_tree",
+        .workload = "pairs_single_traversal",
+        .variant = variant,
+        .size = size,
+        .ops = 1,
+        .results = pairs,
+        .seconds = (double)(now_nanoseconds() - start) * 1e-9,
+    };
+    print_bench_result(&single_result);
+
+    pairs = 0;
+    start = now_nanoseconds();
+    for (size_t i = 0; i < size; i++) {
+        int found_count = 0;
+        loose_quad_tree_search(tree, boxes[i], found, &found_count, (int)size);
+        // Each pair is found from both sides.
+        for (int j = 0; j < found_count; j++) {
+            pairs += found[j] > i;
+        }
+    }
+    BenchResult per_object_result = {
+        .benchmark = "quad_tree",
+        .workload = "pairs_query_per_object",
+        .variant = variant,
+        .size = size,
+        .ops = 1,
+        .results = pairs,
+        .seconds = (double)(now_nanoseconds() - start) * 1e-9,
+    };
+    print_bench_result(&per_object_result);
+
+    free_loose_quad_tree(tree);
+    free(found);
+    free(boxes);
+    free(points);
+}
+
+static void run_quad_tree_size(const BenchConfig* config, size_t size, PointDistribution distribution, uint32_t leaf_capacity) {
+    static const char* distribution_names[] = {"uniform", "clustered"};
+    char variant[64];
+    snprintf(variant, sizeof(variant), "%s_leaf%u", distribution_names[distribution], leaf_capacity);
+
+    uint64_t rng_state = config->seed ^ (uint64_t)size ^ ((uint64_t)distribution << 32);
+    Point* points = generate_points(size, distribution, &rng_state);
+    Point* found = (Point*)malloc(size * sizeof(Point));
+    assert(found != NULL);
+
+    QuadTreeBenchContext context = {
+        .tree = create_new_tree_with_leaf_capacity(create_rect(0.0f, 0.0f, WORLD_HALF_SIZE, WORLD_HALF_SIZE), leaf_capacity),
+        .points = points,
+        .point_count = size,
+        .found = found,
+        .max_found = (int)size,
+        .rng_state = rng_state,
+    };
+
+    run_build_bulk(points, size, leaf_capacity, variant);
+
+    BenchResult insert_result = {
+        .benchmark = "quad_tree",
+        .workload = "insert",
+        .variant = variant,
+        .size = size,
+        .ops = size,
+    };
+    run_bench_operations(&insert_result, insert_operation, &context);
+    print_tree_stats(context.tree, size, variant);
+
+    static const double selectivities[] = {0.0001, 0.001, 0.01, 0.1};
+    static const char* rect_names[] = {"rect_query_0.01pct", "rect_query_0.1pct", "rect_query_1pct", "rect_query_10pct"};
+    static const char* circle_names[] = {"circle_query_0.01pct", "circle_query_0.1pct", "circle_query_1pct", "circle_query_10pct"};
+    static const char* rect_each_names[] = {"rect_each_0.01pct", "rect_each_0.1pct", "rect_each_1pct", "rect_each_10pct"};
+    static const char* rect_count_names[] = {"rect_count_0.01pct", "rect_count_0.1pct", "rect_count_1pct", "rect_count_10pct"};
+    for (size_t i = 0; i < sizeof(selectivities) / sizeof(selectivities[0]); i++) {
+        context.selectivity = selectivities[i];
+
+        BenchResult rect_result = {
+            .benchmark = "quad_tree",
+            .workload = rect_names[i],
+            .variant = variant,
+            .size = size,
+            .ops = config->quad_tree_queries,
+        };
+        run_bench_operations(&rect_result, rect_query_operation, &context);
+
+        BenchResult circle_result = {
+            .benchmark = "quad_tree",
+            .workload = circle_names[i],
+            .variant = variant,
+            .size = size,
+            .ops = config->quad_tree_queries,
+        };
+        run_bench_operations(&circle_result, circle_query_operation, &context);
+
+        BenchResult rect_each_result = {
+            .benchmark = "quad_tree",
+            .workload = rect_each_names[i],
+            .variant = variant,
+            .size = size,
+            .ops = config->quad_tree_queries,
+        };
+        run_bench_operations(&rect_each_result, rect_each_operation, &context);
+
+        BenchResult rect_count_result = {
+            .benchmark = "quad_tree",
+            .workload = rect_count_names[i],
+            .variant = variant,
+            .size = size,
+            .ops = config->quad_tree_queries,
+        };
+        run_bench_operations(&rect_count_result, rect_count_operation, &context);
+    }
+
+    context.selectivity = 0.01;
+    run_batch_queries(config, &context, variant);
+    run_snapshot(config, &context, variant);
+
+    static const int knn_counts[] = {1, 16};
+    static const char* knn_names[] = {"knn_1", "knn_16"};
+    for (size_t i = 0; i < sizeof(knn_counts) / sizeof(knn_counts[0]); i++) {
+        context.k = knn_counts[i];
+
+        BenchResult knn_result = {
+            .benchmark = "quad_tree",
+            .workload = knn_names[i],
+            .variant = variant,
+            .size = size,
+            .ops = config->quad_tree_queries,
+        };
+        run_bench_operations(&knn_result, knn_operation, &context);
+    }
+
+    run_distance_joins(&context, variant);
+    free_quad_tree(context.tree);
+
+    run_moves(config, points, size, leaf_capacity, variant);
+
+    free(found);
+    free(points);
+}
+
+void run_quad_tree_benchmarks(const BenchConfig* config) {
+    static const uint32_t swept_leaf_capacities[] = {4, 8, 16, 32, 64};
+    const uint32_t* leaf_capacities = &config->quad_tree_leaf_capacity;
+    size_t leaf_capacity_count = 1;
+    if (config->quad_tree_leaf_capacity == 0) {
+        leaf_capacities = swept_leaf_capacities;
+        leaf_capacity_count = sizeof(swept_leaf_capacities) / sizeof(swept_leaf_capacities[0]);
+    }
+
+    for (size_t size = 1000; size <= config->max_quad_tree_points; size *= 10) {
+        for (size_t i = 0; i < leaf_capacity_count; i++) {
+            run_quad_tree_size(config, size, POINT_DISTRIBUTION_UNIFORM, leaf_capacities[i]);
+            run_quad_tree_size(config, size, POINT_DISTRIBUTION_CLUSTERED, leaf_capacities[i]);
+        }
+        run_overlapping_pairs(config, size, POINT_DISTRIBUTION_UNIFORM);
+        run_overlapping_pairs(config, size, POINT_DISTRIBUTION_CLUSTERED);
+    }
+}
@@ -1,15 +1,27 @@
 #include <assert.h>
+#include <math.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 
+#include "concurrent_hash_table.h"
+#include "concurrent_quad_tree.h"
 #include "hash_table.h"
+#include "loose_quad_tree.h"
 #include "quad_tree.h"
 
-static void hash_table_example() {
+static void print_log_message(const char* message, void* context) {
+    (void)context;
+    fprintf(stderr, "%s\n", message);
+}
+
+static void hash_table_example(HashTableProbing probing) {
     HashTable hash_table = {0};
-    initialize_hash_table(&hash_table);
+    initialize_hash_table_with_probing(&hash_table, probing);
 
     const uint64_t max_count = 900;
     uint64_t k = 12;
@@ -37,6 +49,10 @@ static void hash_table_example() {
         assert(*result == value);
     }
 
+    HashTableStats stats;
+    hash_table_get_stats(&hash_table, &stats);
+    fprintf(stderr, "Load factor %.2f, mean probe distance %.2f, max probe distance %zu\n", stats.load_factor, stats.mean_probe_distance, stats.max_probe_distance);
+
     for (int i = 0; i < max_count; i++) {
         uint64_t key = (i + 1);
         assert(hash_table_delete_entry(&hash_table, key));
@@ -47,6 +63,78 @@ static void hash_table_example() {
     destroy_hash_table(&hash_table);
 }
 
+#define STRESS_STABLE_KEYS    10000
+#define STRESS_CHURN_KEYS     5000
+#define STRESS_WRITER_THREADS 2
+#define STRESS_READER_THREADS 4
+#define STRESS_ROUNDS         20
+
+typedef struct StressContext {
+    ConcurrentHashTable* table;
+    uint64_t first_key;
+} StressContext;
+
+static int stress_writer(void* arg) {
+    StressContext* context = (StressContext*)arg;
+    for (int round = 0; round < STRESS_ROUNDS; round++) {
+        for (uint64_t key = context->first_key; key < context->first_key + STRESS_CHURN_KEYS; key++) {
+            bool inserted = concurrent_hash_table_insert(context->table, key, (uint32_t)key);
+            assert(inserted);
+            (void)inserted;
+        }
+        for (uint64_t key = context->first_key; key < context->first_key + STRESS_CHURN_KEYS; key++) {
+            uint32_t value = 0;
+            bool found = concurrent_hash_table_get_entry(context->table, key, &value);
+            assert(found && value == (uint32_t)key);
+            bool deleted = concurrent_hash_table_delete_entry(context->table, key);
+            assert(deleted);
+            (void)found;
+            (void)deleted;
+        }
+    }
+    return 0;
+}
+
+static int stress_reader(void* arg) {
+    StressContext* context = (StressContext*)arg;
+    for (int round = 0; round < STRESS_ROUNDS; round++) {
+        for (uint64_t key = 0; key < STRESS_STABLE_KEYS; key++) {
+            uint32_t value = 0;
+            bool found = concurrent_hash_table_get_entry(context->table, key, &value);
+            assert(found && value == (uint32_t)(key * 3));
+            (void)found;
+        }
+    }
+    return 0;
+}
+
+static void concurrent_hash_table_example() {
+    ConcurrentHashTable table = {0};
+    initialize_concurrent_hash_table(&table, 0);
+
+    for (uint64_t key = 0; key < STRESS_STABLE_KEYS; key++) {
+        concurrent_hash_table_insert(&table, key, (uint32_t)(key * 3));
+    }
+
+    thrd_t threads[STRESS_WRITER_THREADS + STRESS_READER_THREADS];
+    StressContext contexts[STRESS_WRITER_THREADS + STRESS_READER_THREADS];
+    for (int i = 0; i < STRESS_WRITER_THREADS + STRESS_READER_THREADS; i++) {
+        bool is_writer = i < STRESS_WRITER_THREADS;
+        contexts[i].table = &table;
+        contexts[i].first_key = STRESS_STABLE_KEYS + (uint64_t)i * STRESS_CHURN_KEYS;
+        int status = thrd_create(&threads[i], is_writer ? stress_writer : stress_reader, &contexts[i]);
+        assert(status == thrd_success);
+        (void)status;
+    }
+    for (int i = 0; i < STRESS_WRITER_THREADS + STRESS_READER_THREADS; i++) {
+        thrd_join(threads[i], NULL);
+    }
+
+    assert(concurrent_hash_table_count(&table) == STRESS_STABLE_KEYS);
+    fprintf(stderr, "Concurrent stress test finished with %zu keys\n", concurrent_hash_table_count(&table));
+    destroy_concurrent_hash_table(&table);
+}
+
 #define MAX_FOUND 100
 static const Point points[] = {
     {
@@ -101,6 +189,10 @@ static void quad_tree_example() {
     }
     print_quad_tree(tree, 0);
 
+    QuadTreeStats stats;
+    quad_tree_get_stats(tree, &stats);
+    fprintf(stderr, "%zu nodes, max depth %zu, leaf fill factor %.2f, %zu bytes\n", stats.node_count, stats.max_depth, stats.leaf_fill_factor, stats.memory_bytes);
+
     Point points_found[MAX_FOUND];
     int found_count = 0;
     Rect range = create_rect(0.0f, 0.0f, 3.0f, 3.0f);
@@ -111,6 +203,19 @@ static void quad_tree_example() {
         fprintf(stderr, "\t(%.2f, %.2f)\n", points_found[i].x, points_found[i].y);
     }
 
+    // Same query read back a few points at a time.
+    QuadTreeCursor cursor;
+    initialize_quad_tree_rect_cursor(&cursor, tree, range);
+    size_t chunk_count;
+    size_t cursor_total = 0;
+    while ((chunk_count = quad_tree_cursor_next(&cursor, points_found, 2)) > 0) {
+        fprintf(stderr, "Cursor chunk of %zu points\n", chunk_count);
+        cursor_total += chunk_count;
+    }
+    destroy_quad_tree_cursor(&cursor);
+    assert(cursor_total == (size_t)found_count);
+    (void)cursor_total;
+
     Point buf[100];
     size_t buf_count = 0;
     memset(buf, 0, sizeof(buf));
@@ -132,7 +237,9 @@ static void quad_tree_example() {
     for (int i = 0; i < buf_count; i++) {
         fprintf(stderr, "\n\n--------------------------\n");
         fprintf(stderr, "Removing Point (%.2f, %.2f)\n", buf[i].x, buf[i].y);
-        assert(remove_point_from_quad_tree(tree, buf[i]));
+        bool removed = remove_point_from_quad_tree(tree, buf[i]);
+        assert(removed);
+        (void)removed;
 
         print_quad_tree(tree, 0);
     }
@@ -142,8 +249,653 @@ static void quad_tree_example() {
     free_quad_tree(tree);
 }
 
+static float next_example_coordinate(uint64_t* state, float center, float half_size) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    double unit = (double)(*state >> 11) * (1.0 / 9007199254740992.0);
+    return center + (float)(unit * 2.0 - 1.0) * half_size;
+}
+
+#define CHECK_POINTS  2000
+#define CHECK_QUERIES 50
+#define CHECK_K       10
+
+static const Rect check_bounds = {.center = {.x = 12.5f, .y = -7.25f}, .half_width = 100.0f, .half_height = 60.0f};
+
+static void fill_check_points(Point* points, size_t count, uint64_t seed) {
+    for (size_t i = 0; i < count; i++) {
+        points[i].x = next_example_coordinate(&seed, check_bounds.center.x, check_bounds.half_width);
+        points[i].y = next_example_coordinate(&seed, check_bounds.center.y, check_bounds.half_height);
+    }
+}
+
+static float squared_distance_between(Point a, Point b) {
+    return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y);
+}
+
+static int compare_floats(const void* a, const void* b) {
+    float left = *(const float*)a;
+    float right = *(const float*)b;
+    return (left > right) - (left < right);
+}
+
+// The k nearest points must have the same distances as the k smallest in a
+// sorted list of every distance.
+static void quad_tree_knn_example() {
+    Point* points = (Point*)malloc(CHECK_POINTS * sizeof(Point));
+    float* distances = (float*)malloc(CHECK_POINTS * sizeof(float));
+    assert(points != NULL && distances != NULL);
+    fill_check_points(points, CHECK_POINTS, 0x2545F4914F6CDD1Dull);
+
+    QuadTree* tree = create_new_tree(check_bounds);
+    for (size_t i = 0; i < CHECK_POINTS; i++) {
+        insert_point_into_quadtree(tree, points[i]);
+    }
+
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (int query = 0; query < CHECK_QUERIES; query++) {
+        Point center = {
+            .x = next_example_coordinate(&state, check_bounds.center.x, check_bounds.half_width),
+            .y = next_example_coordinate(&state, check_bounds.center.y, check_bounds.half_height),
+        };
+        for (size_t i = 0; i < CHECK_POINTS; i++) {
+            distances[i] = squared_distance_between(center, points[i]);
+        }
+        qsort(distances, CHECK_POINTS, sizeof(float), compare_floats);
+
+        Point nearest[CHECK_K];
+        int found_count = quad_tree_knn(tree, center, CHECK_K, nearest);
+        assert(found_count == CHECK_K);
+        for (int i = 0; i < found_count; i++) {
+            assert(squared_distance_between(center, nearest[i]) == distances[i]);
+        }
+
+        Point closest;
+        bool found = quad_tree_nearest(tree, center, &closest);
+        assert(found && squared_distance_between(center, closest) == distances[0]);
+        (void)found;
+    }
+
+    fprintf(stderr, "knn matched brute force for %d queries\n", CHECK_QUERIES);
+    free_quad_tree(tree);
+    free(distances);
+    free(points);
+}
+
+static Rect random_check_rect(uint64_t* state) {
+    float x = next_example_coordinate(state, check_bounds.center.x, check_bounds.half_width);
+    float y = next_example_coordinate(state, check_bounds.center.y, check_bounds.half_height);
+    float half_width = next_example_coordinate(state, 15.0f, 15.0f);
+    float half_height = next_example_coordinate(state, 15.0f, 15.0f);
+    return create_rect(x, y, half_width, half_height);
+}
+
+static size_t count_points_in_rect(const Point* points, size_t count, Rect range) {
+    size_t inside = 0;
+    for (size_t i = 0; i < count; i++) {
+        inside += is_point_inside_rect(range, points[i]);
+    }
+    return inside;
+}
+
+// Feeds the bulk build repeated points and points outside the bounds, which
+// it must skip, and compares range searches with a loop over the points.
+static void quad_tree_bulk_example() {
+    size_t unique_count = CHECK_POINTS;
+    size_t input_count = unique_count + unique_count / 10 + 2;
+    Point* points = (Point*)malloc(input_count * sizeof(Point));
+    Point* found = (Point*)malloc(input_count * sizeof(Point));
+    assert(points != NULL && found != NULL);
+    fill_check_points(points, unique_count, 0xDA942042E4DD58B5ull);
+    for (size_t i = 0; i < unique_count / 10; i++) {
+        points[unique_count + i] = points[i * 10];
+    }
+    points[input_count - 2] = (Point){.x = check_bounds.center.x + 2.0f * check_bounds.half_width, .y = check_bounds.center.y};
+    points[input_count - 1] = (Point){.x = check_bounds.center.x, .y = check_bounds.center.y - 2.0f * check_bounds.half_height};
+
+    QuadTree* tree = quad_tree_build_bulk(check_bounds, points, input_count, 8);
+    int found_count = 0;
+    search_space_in_tree(tree, check_bounds, found, &found_count, (int)input_count);
+    assert((size_t)found_count == unique_count);
+
+    uint64_t state = 0x853C49E6748FEA9Bull;
+    for (int query = 0; query < CHECK_QUERIES; query++) {
+        Rect range = random_check_rect(&state);
+        found_count = 0;
+        search_space_in_tree(tree, range, found, &found_count, (int)input_count);
+        assert((size_t)found_count == count_points_in_rect(points, unique_count, range));
+    }
+
+    fprintf(stderr, "Bulk build matched brute force for %d queries\n", CHECK_QUERIES);
+    free_quad_tree(tree);
+    free(found);
+    free(points);
+}
+
+// Counts must agree with the number of points the matching search returns
+// and with a loop over the points, including ranges that cover whole
+// subtrees.
+static void quad_tree_count_example() {
+    Point* points = (Point*)malloc(CHECK_POINTS * sizeof(Point));
+    Point* found = (Point*)malloc(CHECK_POINTS * sizeof(Point));
+    assert(points != NULL && found != NULL);
+    fill_check_points(points, CHECK_POINTS, 0x5851F42D4C957F2Dull);
+
+    QuadTree* tree = create_new_tree_with_leaf_capacity(check_bounds, 8);
+    for (size_t i = 0; i < CHECK_POINTS; i++) {
+        insert_point_into_quadtree(tree, points[i]);
+    }
+    assert(quad_tree_count_in_rect(tree, check_bounds) == CHECK_POINTS);
+
+    uint64_t state = 0x14057B7EF767814Full;
+    for (int query = 0; query < CHECK_QUERIES; query++) {
+        Rect range = random_check_rect(&state);
+        int found_count = 0;
+        search_space_in_tree(tree, range, found, &found_count, CHECK_POINTS);
+        size_t count = quad_tree_count_in_rect(tree, range);
+        assert(count == (size_t)found_count && count == count_points_in_rect(points, CHECK_POINTS, range));
+
+        Circle circle = {.center = range.center, .radius = range.half_width};
+        size_t expected = 0;
+        for (size_t i = 0; i < CHECK_POINTS; i++) {
+            expected += is_point_inside_circle(circle, points[i]);
+        }
+        found_count = 0;
+        search_circle_in_tree(tree, circle, found, &found_count, CHECK_POINTS);
+        count = quad_tree_count_in_circle(tree, circle);
+        assert(count == (size_t)found_count && count == expected);
+        (void)count;
+        (void)expected;
+    }
+
+    fprintf(stderr, "Counts matched brute force for %d queries\n", CHECK_QUERIES);
+    free_quad_tree(tree);
+    free(found);
+    free(points);
+}
+
+#define MOVE_TEST_POINTS  2000
+#define MOVE_TEST_CENTERS 256
+
+// Moves points onto and one ulp either side of internal node centers, with
+// bounds whose centers do not round cleanly. A moved point must then be
+// found, block duplicates and be removable by position, like an inserted one.
+static void quad_tree_move_example() {
+    Rect bounds = create_rect(123.456f, -78.9f, 1000.3f, 700.7f);
+    QuadTree* tree = create_new_tree_with_leaf_capacity(bounds, 4);
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (uint64_t id = 0; id < MOVE_TEST_POINTS; id++) {
+        Point point = {
+            .x = next_example_coordinate(&state, bounds.center.x, bounds.half_width),
+            .y = next_example_coordinate(&state, bounds.center.y, bounds.half_height),
+        };
+        quad_tree_insert_with_id(tree, point, id);
+    }
+
+    Point centers[MOVE_TEST_CENTERS];
+    size_t center_count = 0;
+    uint32_t queue[4 * MOVE_TEST_CENTERS + 1];
+    size_t queue_begin = 0;
+    size_t queue_end = 0;
+    queue[queue_end++] = 0;
+    while (queue_begin < queue_end && center_count < MOVE_TEST_CENTERS) {
+        const QuadTreeNode* node = &tree->nodes[queue[queue_begin++]];
+        if (node->first_child == QUAD_TREE_NULL_NODE)
+            continue;
+        centers[center_count++] = node->bounds.center;
+        for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN && queue_end < sizeof(queue) / sizeof(queue[0]); i++) {
+            queue[queue_end++] = node->first_child + i;
+        }
+    }
+
+    Point moved[MOVE_TEST_CENTERS * 9];
+    size_t moved_count = 0;
+    uint64_t id = 0;
+    for (size_t c = 0; c < center_count; c++) {
+        float xs[] = {nextafterf(centers[c].x, -INFINITY), centers[c].x, nextafterf(centers[c].x, INFINITY)};
+        float ys[] = {nextafterf(centers[c].y, -INFINITY), centers[c].y, nextafterf(centers[c].y, INFINITY)};
+        for (int i = 0; i < 9; i++) {
+            Point position = {.x = xs[i % 3], .y = ys[i / 3]};
+            bool was_moved = quad_tree_move(tree, id, position);
+            if (!was_moved)
+                continue;
+
+            Point found[2];
+            int found_count = 0;
+            search_space_in_tree(tree, create_rect(position.x, position.y, 0.0f, 0.0f), found, &found_count, 2);
+            assert(found_count == 1);
+            bool inserted = insert_point_into_quadtree(tree, position);
+            assert(!inserted);
+            (void)inserted;
+            moved[moved_count++] = position;
+            ++id;
+        }
+    }
+
+    for (size_t i = 0; i < moved_count; i++) {
+        bool removed = remove_point_from_quad_tree(tree, moved[i]);
+        assert(removed);
+        (void)removed;
+    }
+    assert(quad_tree_count_in_rect(tree, bounds) == MOVE_TEST_POINTS - moved_count);
+    fprintf(stderr, "Moved %zu points onto node center lines\n", moved_count);
+    free_quad_tree(tree);
+}
+
+// Moves and removes points by id while keeping a plain array of where each
+// one should be, then checks lookups and searches against that array.
+static void quad_tree_id_example() {
+    Point* positions = (Point*)malloc(CHECK_POINTS * sizeof(Point));
+    bool* present = (bool*)malloc(CHECK_POINTS * sizeof(bool));
+    Point* found = (Point*)malloc(CHECK_POINTS * sizeof(Point));
+    assert(positions != NULL && present != NULL && found != NULL);
+    fill_check_points(positions, CHECK_POINTS, 0xB5026F5AA96619E9ull);
+
+    QuadTree* tree = create_new_tree_with_leaf_capacity(check_bounds, 8);
+    for (size_t id = 0; id < CHECK_POINTS; id++) {
+        present[id] = quad_tree_insert_with_id(tree, positions[id], id);
+        assert(present[id]);
+    }
+    bool inserted = quad_tree_insert_with_id(tree, check_bounds.center, 0);
+    assert(!inserted);
+    (void)inserted;
+
+    uint64_t state = 0xC2B2AE3D27D4EB4Full;
+    for (size_t round = 0; round < 4 * CHECK_POINTS; round++) {
+        uint64_t id = (uint64_t)(next_example_coordinate(&state, 0.5f, 0.5f) * (float)CHECK_POINTS) % CHECK_POINTS;
+        Point target = positions[id];
+        target.x += next_example_coordinate(&state, 0.0f, 2.0f);
+        target.y += next_example_coordinate(&state, 0.0f, 2.0f);
+        if (round % 7 == 0) {
+            bool removed = quad_tree_remove_id(tree, id);
+            assert(removed == present[id]);
+            present[id] = false;
+            (void)removed;
+            continue;
+        }
+
+        bool moved = quad_tree_move(tree, id, target);
+        assert(!moved || present[id]);
+        if (moved)
+            positions[id] = target;
+        if (round % 64 == 0)
+            quad_tree_rebalance(tree);
+    }
+
+    size_t present_count = 0;
+    for (size_t id = 0; id < CHECK_POINTS; id++) {
+        Point position;
+        bool found_id = quad_tree_find_id(tree, id, &position);
+        assert(found_id == present[id]);
+        assert(!found_id || (position.x == positions[id].x && position.y == positions[id].y));
+        present_count += present[id];
+        (void)found_id;
+    }
+    assert(tree->nodes[0].count == present_count);
+
+    for (int query = 0; query < CHECK_QUERIES; query++) {
+        Rect range = random_check_rect(&state);
+        size_t expected = 0;
+        for (size_t id = 0; id < CHECK_POINTS; id++) {
+            expected += present[id] && is_point_inside_rect(range, positions[id]);
+        }
+        int found_count = 0;
+        search_space_in_tree(tree, range, found, &found_count, CHECK_POINTS);
+        assert((size_t)found_count == expected);
+        (void)expected;
+    }
+
+    fprintf(stderr, "Id moves and removes matched brute force with %zu points left\n", present_count);
+    free_quad_tree(tree);
+    free(found);
+    free(present);
+    free(positions);
+}
+
+#define CHECK_CHURN_ROUNDS 100000
+#define CHECK_BURST_POINTS 1000
+
+// A depth-limited leaf holding exactly two buckets of points has a point
+// inserted and removed over and over, which crosses its run boundary each
+// time. The bucket arrays must not grow with the rounds, and after a burst
+// of points comes and goes a rebalance must give the memory back.
+static void quad_tree_overflow_example() {
+    QuadTree* tree = create_new_tree_with_leaf_capacity(check_bounds, 4);
+    quad_tree_set_max_depth(tree, 2);
+    Point corner = {.x = check_bounds.center.x + 1.0f, .y = check_bounds.center.y + 1.0f};
+    for (int i = 0; i < 8; i++) {
+        Point point = {.x = corner.x + (float)i * 0.01f, .y = corner.y};
+        bool inserted = insert_point_into_quadtree(tree, point);
+        assert(inserted);
+        (void)inserted;
+    }
+
+    Point churn_point = {.x = corner.x, .y = corner.y + 0.5f};
+    size_t bucket_count = 0;
+    for (int round = 0; round < CHECK_CHURN_ROUNDS; round++) {
+        bool inserted = insert_point_into_quadtree(tree, churn_point);
+        bool removed = remove_point_from_quad_tree(tree, churn_point);
+        assert(inserted && removed);
+        (void)inserted;
+        (void)removed;
+        if (round == 0)
+            bucket_count = tree->bucket_count;
+    }
+    assert(tree->bucket_count == bucket_count);
+
+    for (int i = 0; i < CHECK_BURST_POINTS; i++) {
+        Point point = {.x = corner.x, .y = corner.y + 1.0f + (float)i * 0.01f};
+        insert_point_into_quadtree(tree, point);
+    }
+    for (int i = 0; i < CHECK_BURST_POINTS; i++) {
+        Point point = {.x = corner.x, .y = corner.y + 1.0f + (float)i * 0.01f};
+        remove_point_from_quad_tree(tree, point);
+    }
+    size_t burst_capacity = tree->bucket_capacity;
+    quad_tree_rebalance(tree);
+    assert(tree->bucket_capacity == 2 && tree->bucket_capacity < burst_capacity);
+    assert(quad_tree_count_in_rect(tree, check_bounds) == 8);
+
+    fprintf(stderr, "Overflow churn kept %zu buckets, rebalance shrank %zu to %zu\n", bucket_count, burst_capacity, tree->bucket_capacity);
+    free_quad_tree(tree);
+}
+
+#define CHECK_BOXES 1000
+
+typedef struct PairTotals {
+    size_t count;
+    uint64_t checksum;
+} PairTotals;
+
+// Order-independent, so the same set of pairs gives the same checksum
+// whichever way round each pair is reported.
+static void add_pair(PairTotals* totals, uint64_t a, uint64_t b) {
+    uint64_t low = a < b ? a : b;
+    uint64_t high = a < b ? b : a;
+    ++totals->count;
+    totals->checksum += (low * 0x9E3779B97F4A7C15ull) ^ (high * 0xC2B2AE3D27D4EB4Full);
+}
+
+static bool add_overlapping_pair(const LooseQuadTreeEntry* a, const LooseQuadTreeEntry* b, void* context) {
+    add_pair((PairTotals*)context, a->id, b->id);
+    return true;
+}
+
+// Every overlapping pair of boxes must be reported exactly once, which a
+// double loop over the boxes confirms.
+static void loose_quad_tree_example() {
+    Rect* boxes = (Rect*)malloc(CHECK_BOXES * sizeof(Rect));
+    assert(boxes != NULL);
+    uint64_t state = 0x94D049BB133111EBull;
+    LooseQuadTree* tree = create_new_loose_quad_tree(check_bounds);
+    for (size_t i = 0; i < CHECK_BOXES; i++) {
+        float x = next_example_coordinate(&state, check_bounds.center.x, check_bounds.half_width);
+        float y = next_example_coordinate(&state, check_bounds.center.y, check_bounds.half_height);
+        // A few large boxes stay high up in the tree.
+        float size = i % 50 == 0 ? 20.0f : 2.0f;
+        boxes[i] = create_rect(x, y, next_example_coordinate(&state, size, size), next_example_coordinate(&state, size, size));
+        bool inserted = loose_quad_tree_insert(tree, boxes[i], i);
+        assert(inserted);
+        (void)inserted;
+    }
+
+    PairTotals expected = {0};
+    for (size_t i = 0; i < CHECK_BOXES; i++) {
+        for (size_t j = i + 1; j < CHECK_BOXES; j++) {
+            if (rects_intersect(boxes[i], boxes[j]))
+                add_pair(&expected, i, j);
+        }
+    }
+
+    PairTotals found = {0};
+    bool finished = quad_tree_find_all_overlapping_pairs(tree, add_overlapping_pair, &found);
+    assert(finished && found.count == expected.count && found.checksum == expected.checksum);
+    (void)finished;
+
+    fprintf(stderr, "Loose quad tree found all %zu overlapping pairs\n", found.count);
+    free_loose_quad_tree(tree);
+    free(boxes);
+}
+
+#define CHECK_JOIN_RADIUS 3.0f
+
+// The parallel joins call the visitor from several threads at once.
+typedef struct AtomicPairTotals {
+    atomic_size_t count;
+    atomic_uint_fast64_t checksum;
+} AtomicPairTotals;
+
+static bool add_point_pair(Point a, uint64_t a_id, Point b, uint64_t b_id, void* context) {
+    AtomicPairTotals* totals = (AtomicPairTotals*)context;
+    PairTotals pair = {0};
+    add_pair(&pair, a_id, b_id);
+    (void)a;
+    (void)b;
+    atomic_fetch_add(&totals->count, 1);
+    atomic_fetch_add(&totals->checksum, pair.checksum);
+    return true;
+}
+
+static void check_join(bool finished, AtomicPairTotals* found, const PairTotals* expected) {
+    assert(finished && atomic_load(&found->count) == expected->count && atomic_load(&found->checksum) == expected->checksum);
+    (void)finished;
+    (void)expected;
+    atomic_store(&found->count, 0);
+    atomic_store(&found->checksum, 0);
+}
+
+// Self and two-tree joins, serial and parallel, must report the same pairs
+// as a double loop. Ids in the second tree are offset so that pairs across
+// the trees stay distinct.
+static void quad_tree_join_example() {
+    Point* points = (Point*)malloc(2 * CHECK_POINTS * sizeof(Point));
+    assert(points != NULL);
+    fill_check_points(points, 2 * CHECK_POINTS, 0x632BE59BD9B4E019ull);
+
+    QuadTree* a = create_new_tree_with_leaf_capacity(check_bounds, 8);
+    QuadTree* b = create_new_tree_with_leaf_capacity(check_bounds, 8);
+    for (size_t i = 0; i < CHECK_POINTS; i++) {
+        quad_tree_insert_with_id(a, points[i], i);
+        quad_tree_insert_with_id(b, points[CHECK_POINTS + i], CHECK_POINTS + i);
+    }
+
+    PairTotals expected_self = {0};
+    PairTotals expected_between = {0};
+    for (size_t i = 0; i < CHECK_POINTS; i++) {
+        Circle circle = {.center = points[i], .radius = CHECK_JOIN_RADIUS};
+        for (size_t j = i + 1; j < CHECK_POINTS; j++) {
+            if (is_point_inside_circle(circle, points[j]))
+                add_pair(&expected_self, i, j);
+        }
+        for (size_t j = CHECK_POINTS; j < 2 * CHECK_POINTS; j++) {
+            if (is_point_inside_circle(circle, points[j]))
+                add_pair(&expected_between, i, j);
+        }
+    }
+
+    AtomicPairTotals found;
+    atomic_init(&found.count, 0);
+    atomic_init(&found.checksum, 0);
+    check_join(quad_tree_pairs_within(a, CHECK_JOIN_RADIUS, add_point_pair, &found), &found, &expected_self);
+    check_join(quad_tree_join_within(a, b, CHECK_JOIN_RADIUS, add_point_pair, &found), &found, &expected_between);
+
+    quad_tree_freeze(a);
+    quad_tree_freeze(b);
+    check_join(quad_tree_pairs_within_parallel(a, CHECK_JOIN_RADIUS, add_point_pair, &found, 4), &found, &expected_self);
+    check_join(quad_tree_join_within_parallel(a, b, CHECK_JOIN_RADIUS, add_point_pair, &found, 4), &found, &expected_between);
+
+    fprintf(stderr, "Joins matched brute force with %zu self pairs and %zu pairs between trees\n", expected_self.count, expected_between.count);
+    free_quad_tree(b);
+    free_quad_tree(a);
+    free(points);
+}
+
+#define CHECK_SNAPSHOT_PATH "quad_tree_example.snapshot"
+
+// A saved tree opened mapped must answer every query the heap tree answers,
+// and must refuse anything that would write to the file.
+static void quad_tree_snapshot_example() {
+    Point* points = (Point*)malloc(CHECK_POINTS * sizeof(Point));
+    Point* found = (Point*)malloc(CHECK_POINTS * sizeof(Point));
+    assert(points != NULL && found != NULL);
+    fill_check_points(points, CHECK_POINTS, 0xDA942042E4DD58B5ull);
+
+    QuadTree* tree = create_new_tree_with_leaf_capacity(check_bounds, 8);
+    for (size_t i = 0; i < CHECK_POINTS; i++) {
+        quad_tree_insert_with_id(tree, points[i], i);
+    }
+    bool saved = quad_tree_save(tree, CHECK_SNAPSHOT_PATH);
+    assert(saved);
+    (void)saved;
+    QuadTree* mapped = quad_tree_open_mapped(CHECK_SNAPSHOT_PATH);
+    assert(mapped != NULL);
+
+    uint64_t state = 0xBF58476D1CE4E5B9ull;
+    for (int query = 0; query < CHECK_QUERIES; query++) {
+        Rect range = random_check_rect(&state);
+        size_t expected = count_points_in_rect(points, CHECK_POINTS, range);
+        int found_count = 0;
+        search_space_in_tree(mapped, range, found, &found_count, CHECK_POINTS);
+        assert((size_t)found_count == expected && quad_tree_count_in_rect(mapped, range) == expected);
+        for (int i = 0; i < found_count; i++) {
+            assert(is_point_inside_rect(range, found[i]));
+        }
+
+        Point tree_nearest[CHECK_K];
+        Point mapped_nearest[CHECK_K];
+        int tree_count = quad_tree_knn(tree, range.center, CHECK_K, tree_nearest);
+        int mapped_count = quad_tree_knn(mapped, range.center, CHECK_K, mapped_nearest);
+        assert(tree_count == mapped_count);
+        for (int i = 0; i < mapped_count; i++) {
+            assert(squared_distance_between(range.center, tree_nearest[i]) == squared_distance_between(range.center, mapped_nearest[i]));
+        }
+        (void)expected;
+        (void)tree_count;
+    }
+
+    Point position;
+    bool found_id = quad_tree_find_id(mapped, 0, &position);
+    bool inserted = insert_point_into_quadtree(mapped, check_bounds.center);
+    assert(!found_id && !inserted && quad_tree_count_in_rect(mapped, check_bounds) == CHECK_POINTS);
+    (void)found_id;
+    (void)inserted;
+
+    fprintf(stderr, "Mapped snapshot matched the heap tree for %d queries\n", CHECK_QUERIES);
+    free_quad_tree(mapped);
+    free_quad_tree(tree);
+    remove(CHECK_SNAPSHOT_PATH);
+    free(found);
+    free(points);
+}
+
+#define QUAD_STRESS_GRID_POINTS    100
+#define QUAD_STRESS_CHURN_ROWS     50
+#define QUAD_STRESS_WRITER_THREADS 2
+#define QUAD_STRESS_READER_THREADS 4
+#define QUAD_STRESS_ROUNDS         10
+
+typedef struct QuadTreeStressContext {
+    ConcurrentQuadTree* tree;
+    float churn_offset;
+} QuadTreeStressContext;
+
+// Stable points sit on odd coordinates; each writer churns its own points
+// on even x and fractional y, so they never collide with anything else.
+static Point stable_point(int i, int j) {
+    return (Point){.x = (float)(2 * i - 99), .y = (float)(2 * j - 99)};
+}
+
+static Point churn_point(const QuadTreeStressContext* context, int i, int j) {
+    return (Point){.x = (float)(2 * i - 98), .y = (float)(4 * j - 99) + context->churn_offset};
+}
+
+static int quad_tree_stress_writer(void* arg) {
+    QuadTreeStressContext* context = (QuadTreeStressContext*)arg;
+    for (int round = 0; round < QUAD_STRESS_ROUNDS; round++) {
+        for (int i = 0; i < QUAD_STRESS_GRID_POINTS; i++) {
+            for (int j = 0; j < QUAD_STRESS_CHURN_ROWS; j++) {
+                bool inserted = concurrent_quad_tree_insert_point(context->tree, churn_point(context, i, j));
+                assert(inserted);
+                (void)inserted;
+            }
+        }
+        for (int i = 0; i < QUAD_STRESS_GRID_POINTS; i++) {
+            for (int j = 0; j < QUAD_STRESS_CHURN_ROWS; j++) {
+                bool removed = concurrent_quad_tree_remove_point(context->tree, churn_point(context, i, j));
+                assert(removed);
+                (void)removed;
+            }
+        }
+    }
+    return 0;
+}
+
+static int quad_tree_stress_reader(void* arg) {
+    QuadTreeStressContext* context = (QuadTreeStressContext*)arg;
+    Point found[1];
+    for (int round = 0; round < QUAD_STRESS_ROUNDS; round++) {
+        for (int i = 0; i < QUAD_STRESS_GRID_POINTS; i++) {
+            for (int j = 0; j < QUAD_STRESS_GRID_POINTS; j++) {
+                Point point = stable_point(i, j);
+                int found_count = 0;
+                concurrent_quad_tree_search_rect(context->tree, create_rect(point.x, point.y, 0.0f, 0.0f), found, &found_count, 1);
+                assert(found_count == 1 && found[0].x == point.x && found[0].y == point.y);
+            }
+        }
+        size_t count = concurrent_quad_tree_count_in_rect(context->tree, context->tree->bounds);
+        assert(count >= QUAD_STRESS_GRID_POINTS * QUAD_STRESS_GRID_POINTS);
+        assert(count <= QUAD_STRESS_GRID_POINTS * (QUAD_STRESS_GRID_POINTS + QUAD_STRESS_WRITER_THREADS * QUAD_STRESS_CHURN_ROWS));
+        (void)count;
+    }
+    return 0;
+}
+
+static void concurrent_quad_tree_example() {
+    ConcurrentQuadTree tree = {0};
+    initialize_concurrent_quad_tree(&tree, create_rect(0.0f, 0.0f, 100.0f, 100.0f), 0);
+
+    for (int i = 0; i < QUAD_STRESS_GRID_POINTS; i++) {
+        for (int j = 0; j < QUAD_STRESS_GRID_POINTS; j++) {
+            concurrent_quad_tree_insert_point(&tree, stable_point(i, j));
+        }
+    }
+
+    thrd_t threads[QUAD_STRESS_WRITER_THREADS + QUAD_STRESS_READER_THREADS];
+    QuadTreeStressContext contexts[QUAD_STRESS_WRITER_THREADS + QUAD_STRESS_READER_THREADS];
+    for (int i = 0; i < QUAD_STRESS_WRITER_THREADS + QUAD_STRESS_READER_THREADS; i++) {
+        bool is_writer = i < QUAD_STRESS_WRITER_THREADS;
+        contexts[i].tree = &tree;
+        contexts[i].churn_offset = 0.5f + (float)i;
+        int status = thrd_create(&threads[i], is_writer ? quad_tree_stress_writer : quad_tree_stress_reader, &contexts[i]);
+        assert(status == thrd_success);
+        (void)status;
+    }
+    for (int i = 0; i < QUAD_STRESS_WRITER_THREADS + QUAD_STRESS_READER_THREADS; i++) {
+        thrd_join(threads[i], NULL);
+    }
+
+    assert(concurrent_quad_tree_count(&tree) == QUAD_STRESS_GRID_POINTS * QUAD_STRESS_GRID_POINTS);
+    fprintf(stderr, "Concurrent quad tree stress test finished with %zu points\n", concurrent_quad_tree_count(&tree));
+    destroy_concurrent_quad_tree(&tree);
+}
+
 int main() {
-    hash_table_example();
-    //quad_tree_example();
+    hash_table_set_log_hook(print_log_message, NULL);
+    quad_tree_set_log_hook(print_log_message, NULL);
+    hash_table_example(HASH_TABLE_PROBING_ROBIN_HOOD);
+    hash_table_example(HASH_TABLE_PROBING_GROUP);
+    concurrent_hash_table_example();
+    concurrent_quad_tree_example();
+    quad_tree_knn_example();
+    quad_tree_bulk_example();
+    quad_tree_count_example();
+    quad_tree_move_example();
+    quad_tree_id_example();
+    quad_tree_overflow_example();
+    loose_quad_tree_example();
+    quad_tree_join_example();
+    quad_tree_snapshot_example();
+    quad_tree_example();
     return 0;
 }
\ No newline at end of file
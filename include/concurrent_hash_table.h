@@ -0,0 +1,25 @@
+#pragma once
+
+#include "hash_table.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONCURRENT_HASH_TABLE_DEFAULT_SEGMENTS 64
+
+typedef struct ConcurrentHashTableSegment ConcurrentHashTableSegment;
+
+typedef struct ConcurrentHashTable {
+    size_t segment_count;
+    unsigned segment_shift;
+    ConcurrentHashTableSegment* segments;
+} ConcurrentHashTable;
+
+void initialize_concurrent_hash_table(ConcurrentHashTable* table, size_t segment_count);
+void destroy_concurrent_hash_table(ConcurrentHashTable* table);
+size_t concurrent_hash_table_count(const ConcurrentHashTable* table);
+bool concurrent_hash_table_contains_key(const ConcurrentHashTable* table, uint64_t key);
+bool concurrent_hash_table_insert(ConcurrentHashTable* table, uint64_t key, uint32_t value);
+bool concurrent_hash_table_delete_entry(ConcurrentHashTable* table, uint64_t key);
+bool concurrent_hash_table_get_entry(const ConcurrentHashTable* table, uint64_t key, uint32_t* value);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "quad_tree.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CONCURRENT_QUAD_TREE_DEFAULT_GRID_SIZE 8
+
+typedef struct ConcurrentQuadTreeCell ConcurrentQuadTreeCell;
+
+// The bounds are split into grid_size by grid_size cells, each holding its
+// own QuadTree. A point belongs to the cell whose edges contain it, with
+// the lower edge inclusive; x_edges and y_edges hold grid_size + 1 entries.
+typedef struct ConcurrentQuadTree {
+    Rect bounds;
+    size_t grid_size;
+    float* x_edges;
+    float* y_edges;
+    ConcurrentQuadTreeCell* cells;
+} ConcurrentQuadTree;
+
+void initialize_concurrent_quad_tree(ConcurrentQuadTree* tree, Rect bounds, size_t grid_size);
+void destroy_concurrent_quad_tree(ConcurrentQuadTree* tree);
+size_t concurrent_quad_tree_count(const ConcurrentQuadTree* tree);
+bool concurrent_quad_tree_insert_point(ConcurrentQuadTree* tree, Point point);
+bool concurrent_quad_tree_remove_point(ConcurrentQuadTree* tree, Point point);
+// Queries lock one cell at a time, so they see each cell as of the moment
+// they reach it rather than the whole tree at one instant.
+void concurrent_quad_tree_search_rect(const ConcurrentQuadTree* tree, Rect range, Point* found, int* found_count, int max_count);
+void concurrent_quad_tree_search_circle(const ConcurrentQuadTree* tree, Circle range, Point* found, int* found_count, int max_count);
+size_t concurrent_quad_tree_count_in_rect(const ConcurrentQuadTree* tree, Rect range);
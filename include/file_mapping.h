@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct FileMapping {
+    void* data;
+    size_t size;
+} FileMapping;
+
+// A writable mapping is private: writes land in copy-on-write pages and are
+// never written back to the file.
+bool open_file_mapping(FileMapping* mapping, const char* path, bool writable);
+void close_file_mapping(FileMapping* mapping);
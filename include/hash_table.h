@@ -1,24 +1,93 @@
 #pragma once
 
+#include "file_mapping.h"
+
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <xxhash.h>
 
-typedef struct Node Node;
+typedef enum HashTableProbing {
+    HASH_TABLE_PROBING_ROBIN_HOOD,
+    HASH_TABLE_PROBING_GROUP,
+} HashTableProbing;
 
-typedef struct HashTable {
+typedef enum HashTableMapMode {
+    HASH_TABLE_MAP_READ_ONLY,
+    HASH_TABLE_MAP_COPY_ON_WRITE,
+} HashTableMapMode;
+
+#define HASH_TABLE_PROBE_HISTOGRAM_BUCKETS 16
+
+typedef void (*HashTableLogHook)(const char* message, void* context);
+
+typedef struct HashTableSlots {
     size_t capacity;
+    uint8_t* metadata;
+    uint64_t* keys;
+    uint32_t* values;
+} HashTableSlots;
+
+typedef struct HashTable {
     size_t count;
     size_t nodes_visited;
-    Node* nodes;
+    HashTableSlots slots;
+    // Slots still being drained by an incremental resize; capacity is 0
+    // when no resize is in progress.
+    HashTableSlots old_slots;
+    size_t migration_index;
     XXH64_hash_t seed;
+    HashTableProbing probing;
+    bool incremental_resize;
+    // Set when the slots live in a snapshot opened by hash_table_open_mapped.
+    FileMapping mapping;
+    bool read_only;
+#if defined(HASH_TABLE_ENABLE_STATS)
+    size_t resize_count;
+    uint64_t resize_nanoseconds;
+#endif
 } HashTable;
 
+typedef struct HashTableStats {
+    size_t capacity;
+    size_t count;
+    double load_factor;
+    size_t nodes_visited;
+    size_t tombstones;
+    size_t max_probe_distance;
+    double mean_probe_distance;
+    // Entries by distance from their home slot (Robin Hood) or home group
+    // (group probing); the last bucket also counts everything further out.
+    size_t probe_histogram[HASH_TABLE_PROBE_HISTOGRAM_BUCKETS];
+    // Non-zero while an incremental resize is still draining old slots.
+    size_t old_capacity;
+    // Only tracked when built with HASH_TABLE_ENABLE_STATS.
+    size_t resize_count;
+    double resize_seconds;
+} HashTableStats;
+
+void hash_table_set_log_hook(HashTableLogHook hook, void* context);
+
 void initialize_hash_table(HashTable* table);
+void initialize_hash_table_with_probing(HashTable* table, HashTableProbing probing);
 void destroy_hash_table(HashTable* table);
+void hash_table_set_incremental_resize(HashTable* table, bool enabled);
+void hash_table_reserve(HashTable* table, size_t count);
 bool hash_table_contains_key(const HashTable* table, uint64_t key);
 bool hash_table_insert(HashTable* table, uint64_t key, uint32_t value);
 bool hash_table_delete_entry(HashTable* table, uint64_t key);
-uint32_t* hash_table_get_entry(HashTable* table, uint64_t key);
\ No newline at end of file
+// Lookups never migrate slots, even during an incremental resize, so the
+// returned pointer stays valid until the next insert, delete or reserve.
+uint32_t* hash_table_get_entry(HashTable* table, uint64_t key);
+size_t hash_table_get_entries_batch(const HashTable* table, const uint64_t* keys, size_t count, uint32_t* out_values, bool* out_found);
+bool hash_table_insert_batch(HashTable* table, const uint64_t* keys, const uint32_t* values, size_t count);
+// Fills an empty table from parallel arrays, sizing it once and building on
+// all cores. Duplicate keys keep the last value, as with repeated inserts.
+bool hash_table_build_from_arrays(HashTable* table, const uint64_t* keys, const uint32_t* values, size_t count);
+bool hash_table_save(HashTable* table, const char* path);
+// Read-only tables reject inserts and deletes, and the pointer returned by
+// hash_table_get_entry must not be written through. Copy-on-write tables
+// move to heap memory on their first insert or delete.
+bool hash_table_open_mapped(HashTable* table, const char* path, HashTableMapMode mode);
+void hash_table_get_stats(const HashTable* table, HashTableStats* stats);
\ No newline at end of file
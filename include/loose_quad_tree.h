@@ -0,0 +1,54 @@
+#pragma once
+
+#include "quad_tree.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOOSE_QUAD_TREE_NODE_CAPACITY 8
+#define LOOSE_QUAD_TREE_MAX_DEPTH     16
+
+typedef struct LooseQuadTreeEntry {
+    Rect bounds;
+    uint64_t id;
+} LooseQuadTreeEntry;
+
+// Entries are stored in the deepest node whose region holds their center
+// and whose loose bounds, twice the size of its region, hold the whole box.
+// Boxes too large for any child stay in the node above, so a node keeps
+// entries even after it has children. count covers the whole subtree.
+typedef struct LooseQuadTreeNode {
+    Rect bounds;
+    uint32_t count;
+    uint32_t first_child;
+    uint32_t depth;
+    uint32_t entry_count;
+    size_t entry_capacity;
+    LooseQuadTreeEntry* entries;
+} LooseQuadTreeNode;
+
+// Nodes share one pool as in QuadTree, with the root at nodes[0] and
+// released sibling blocks chained through first_child.
+typedef struct LooseQuadTree {
+    LooseQuadTreeNode* nodes;
+    size_t node_count;
+    size_t node_capacity;
+    uint32_t free_block;
+} LooseQuadTree;
+
+// Called once per pair of overlapping entries. Returning false stops the
+// search.
+typedef bool (*LooseQuadTreePairVisitor)(const LooseQuadTreeEntry* a, const LooseQuadTreeEntry* b, void* context);
+
+LooseQuadTree* create_new_loose_quad_tree(Rect bounds);
+void free_loose_quad_tree(LooseQuadTree* tree);
+// Fails when the center of the box lies outside the tree's bounds.
+bool loose_quad_tree_insert(LooseQuadTree* tree, Rect bounds, uint64_t id);
+// bounds must be the ones the entry was inserted with.
+bool loose_quad_tree_remove(LooseQuadTree* tree, Rect bounds, uint64_t id);
+// Writes the ids of entries overlapping range, like search_space_in_tree.
+void loose_quad_tree_search(const LooseQuadTree* tree, Rect range, uint64_t* found, int* found_count, int max_count);
+// Reports every overlapping pair once, in a single traversal. Returns false
+// when the visitor stopped the search early.
+bool quad_tree_find_all_overlapping_pairs(const LooseQuadTree* tree, LooseQuadTreePairVisitor visitor, void* context);
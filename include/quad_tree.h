@@ -1,7 +1,12 @@
 #pragma once
 
+#include "file_mapping.h"
+#include "hash_table.h"
+
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+
 typedef struct Point {
     float x;
     float y;
@@ -18,29 +23,229 @@ typedef struct Circle {
     float radius;
 } Circle;
 
-#define QUAD_TREE_MAX_CHILDREN 4
-#define QUAD_TREE_MAX_POINTS   4
+#define QUAD_TREE_MAX_CHILDREN          4
+#define QUAD_TREE_DEFAULT_LEAF_CAPACITY 64
+#define QUAD_TREE_NULL_NODE             UINT32_MAX
+#define QUAD_TREE_CURSOR_INLINE_DEPTH   64
+// Nodes this deep stop splitting and let their leaf grow instead. 24
+// levels already split a float's range as finely as its mantissa allows.
+#define QUAD_TREE_DEFAULT_MAX_DEPTH       24
+#define QUAD_TREE_DEPTH_HISTOGRAM_BUCKETS 32
+// Id of points inserted without one.
+#define QUAD_TREE_NO_ID UINT64_MAX
+// One free list per power-of-two run of buckets, up to 2^31 buckets.
+#define QUAD_TREE_BUCKET_RUN_CLASSES 32
 
-typedef struct QuadTree {
+// The children of a node are the four pool entries starting at first_child,
+// in NE, NW, SE, SW order. Leaves have no first_child, and keep their points
+// in bucket, which stays unset until the first point arrives.
+typedef struct QuadTreeNode {
     Rect bounds;
-    bool is_leaf;
     uint32_t count;
-    union {
-        Point points[QUAD_TREE_MAX_POINTS];
-        struct QuadTree* children[QUAD_TREE_MAX_CHILDREN];
-    };
+    uint32_t first_child;
+    uint32_t bucket;
+    uint32_t parent;
+} QuadTreeNode;
+
+// All nodes live in one pool and refer to each other by index, with the root
+// at nodes[0]. Released sibling blocks are chained through first_child.
+// Leaf points live in buckets of leaf_capacity entries, with x, y and id in
+// separate arrays so that leaf scans read contiguous floats. The arrays
+// start empty and grow with the leaves. id_slots maps the id of every point
+// that has one to its slot in those arrays, and stays empty until the first
+// insert with an id. bucket_nodes maps a bucket back to the leaf that owns
+// it. Leaves that can no longer split, at max_depth or at the limit of float
+// precision, take a run of consecutive buckets instead, doubled whenever it
+// fills. Free runs are kept on free_runs, one list per run length, so that
+// a run released by one leaf can be taken again by a leaf of any size. A
+// frozen tree rejects every change, which makes it safe to query from many
+// threads.
+// A tree opened from a file keeps its arrays in mapping, with the leaves
+// packed back to back: bucket_size is 1 and a leaf's bucket is its first
+// slot. Such a tree stays frozen and has no id_slots or bucket_nodes.
+typedef struct QuadTree {
+    QuadTreeNode* nodes;
+    size_t node_count;
+    size_t node_capacity;
+    uint32_t free_block;
+    uint32_t leaf_capacity;
+    uint32_t bucket_size;
+    uint32_t max_depth;
+    float* xs;
+    float* ys;
+    uint64_t* ids;
+    uint32_t* bucket_nodes;
+    size_t bucket_count;
+    size_t bucket_capacity;
+    uint32_t free_runs[QUAD_TREE_BUCKET_RUN_CLASSES];
+    HashTable id_slots;
+    bool frozen;
+    FileMapping mapping;
 } QuadTree;
 
+// Called once per point found by the *_each queries, with QUAD_TREE_NO_ID
+// for points inserted without an id. Returning false stops the query.
+typedef bool (*QuadTreeVisitor)(Point point, uint64_t id, void* context);
+
+// Called once per pair of points found by the distance joins. Returning
+// false stops the join.
+typedef bool (*QuadTreePairVisitor)(Point a, uint64_t a_id, Point b, uint64_t b_id, void* context);
+
+typedef void (*QuadTreeLogHook)(const char* message, void* context);
+
+typedef struct QuadTreeStats {
+    size_t point_count;
+    size_t node_count;
+    size_t leaf_count;
+    size_t empty_leaf_count;
+    // Leaves holding more than leaf_capacity points because they could not
+    // split.
+    size_t overflow_leaf_count;
+    size_t max_depth;
+    // Nodes by depth; the last bucket also counts everything deeper.
+    size_t depth_histogram[QUAD_TREE_DEPTH_HISTOGRAM_BUCKETS];
+    // Points over the slots of the buckets that non-empty leaves hold.
+    double leaf_fill_factor;
+    // Bytes held by the pools and the id index, or by the mapping for a
+    // mapped tree.
+    size_t memory_bytes;
+} QuadTreeStats;
+
+// Only tracked when built with QUAD_TREE_ENABLE_STATS.
+typedef struct QuadTreeQueryMetrics {
+    size_t nodes_visited;
+    // Points read from leaves, whether tested against the query or taken
+    // whole from a subtree inside it.
+    size_t points_visited;
+} QuadTreeQueryMetrics;
+
+typedef enum QuadTreeQueryShape {
+    QUAD_TREE_QUERY_RECT,
+    QUAD_TREE_QUERY_CIRCLE,
+} QuadTreeQueryShape;
+
+// Resumable range query. Each quad_tree_cursor_next call picks up where the
+// previous one stopped, so results can be read in chunks of any size with a
+// single traversal. The tree must not change while a cursor is open.
+typedef struct QuadTreeCursor {
+    const QuadTree* tree;
+    QuadTreeQueryShape shape;
+    Rect rect;
+    Circle circle;
+    // Leaf being read, or QUAD_TREE_NULL_NODE between leaves.
+    uint32_t leaf;
+    uint32_t leaf_position;
+    bool leaf_inside;
+    // Nodes still to visit. The stack starts in inline_stack and moves to
+    // spilled_stack once it outgrows it.
+    uint32_t* spilled_stack;
+    size_t stack_count;
+    size_t stack_capacity;
+    uint32_t inline_stack[QUAD_TREE_CURSOR_INLINE_DEPTH];
+} QuadTreeCursor;
+
+typedef struct QuadTreeQuery {
+    QuadTreeQueryShape shape;
+    Rect rect;
+    Circle circle;
+} QuadTreeQuery;
+
+typedef struct QuadTreeResultSpan {
+    const Point* points;
+    size_t count;
+} QuadTreeResultSpan;
+
+// spans[i] holds the points found by the i-th query of a batch. The points
+// live in one buffer per worker thread.
+typedef struct QuadTreeBatchResults {
+    QuadTreeResultSpan* spans;
+    size_t span_count;
+    Point** buffers;
+    size_t buffer_count;
+} QuadTreeBatchResults;
+
+void quad_tree_set_log_hook(QuadTreeLogHook hook, void* context);
+
 bool is_point_inside_rect(Rect rect, Point point);
 bool is_point_inside_circle(Circle circle, Point point);
 bool rects_intersect(Rect a, Rect b);
 bool circle_rect_intersect(Circle circle, Rect rect);
 
 QuadTree* create_new_tree(Rect bounds);
+QuadTree* create_new_tree_with_leaf_capacity(Rect bounds, uint32_t leaf_capacity);
+// Only affects nodes split after the call.
+void quad_tree_set_max_depth(QuadTree* tree, uint32_t max_depth);
+// Builds a tree from a static point set in one pass over the points sorted
+// in Z-order. Points outside bounds and repeated points are skipped. A
+// leaf_capacity of 0 uses QUAD_TREE_DEFAULT_LEAF_CAPACITY.
+QuadTree* quad_tree_build_bulk(Rect bounds, const Point* points, size_t count, uint32_t leaf_capacity);
 Rect create_rect(float x, float y, float half_width, float half_height);
 bool insert_point_into_quadtree(QuadTree* tree, Point point);
 bool remove_point_from_quad_tree(QuadTree* tree, Point point);
+// Points with an id can be moved and removed by id. Moving or removing one
+// never collapses nodes; quad_tree_rebalance does that for the whole tree
+// in one pass, e.g. once per tick, and shrinks the point arrays once leaves
+// use less than half of them. Like plain inserts, these fail when another
+// point already sits at the target position.
+bool quad_tree_insert_with_id(QuadTree* tree, Point point, uint64_t id);
+bool quad_tree_move(QuadTree* tree, uint64_t id, Point position);
+bool quad_tree_remove_id(QuadTree* tree, uint64_t id);
+bool quad_tree_find_id(const QuadTree* tree, uint64_t id, Point* position);
+void quad_tree_rebalance(QuadTree* tree);
+// Inserts, moves and removes fail on a frozen tree, and clearing or
+// rebalancing it does nothing until it is unfrozen.
+void quad_tree_freeze(QuadTree* tree);
+void quad_tree_unfreeze(QuadTree* tree);
 void free_quad_tree(QuadTree* tree);
+// Writes the reachable nodes in breadth-first order with the leaf points
+// packed in the same order, so the file has no pointers and no free space.
+bool quad_tree_save(const QuadTree* tree, const char* path);
+// Maps a saved tree read-only and queries it in place. The nodes are checked
+// in one pass but nothing is copied or allocated per node, and processes
+// mapping the same file share its pages. Returns NULL when the file is not a
+// valid snapshot or any node points outside it. Ids come back with the
+// points, but quad_tree_find_id always fails on a mapped tree.
+QuadTree* quad_tree_open_mapped(const char* path);
+// Drops every point but keeps the pool, for trees rebuilt every frame.
+void quad_tree_clear(QuadTree* tree);
 void search_space_in_tree(const QuadTree* tree, Rect range, Point* found, int* found_count, int max_count);
 void search_circle_in_tree(const QuadTree* tree, Circle range, Point* found, int* found_count, int max_count);
+// Count the points in range without collecting them. Subtrees that lie
+// fully inside the range contribute their stored count.
+size_t quad_tree_count_in_rect(const QuadTree* tree, Rect range);
+size_t quad_tree_count_in_circle(const QuadTree* tree, Circle range);
+// Return false when the visitor stopped the query early.
+bool quad_tree_query_rect_each(const QuadTree* tree, Rect range, QuadTreeVisitor visitor, void* context);
+bool quad_tree_query_circle_each(const QuadTree* tree, Circle range, QuadTreeVisitor visitor, void* context);
+void initialize_quad_tree_rect_cursor(QuadTreeCursor* cursor, const QuadTree* tree, Rect range);
+void initialize_quad_tree_circle_cursor(QuadTreeCursor* cursor, const QuadTree* tree, Circle range);
+// Writes up to max_count more results to out and returns how many. Returns 0
+// once the query is exhausted.
+size_t quad_tree_cursor_next(QuadTreeCursor* cursor, Point* out, size_t max_count);
+// As above, also writing each point's id to ids.
+size_t quad_tree_cursor_next_with_ids(QuadTreeCursor* cursor, Point* out, uint64_t* ids, size_t max_count);
+void destroy_quad_tree_cursor(QuadTreeCursor* cursor);
+// Runs count independent queries on up to thread_count threads, or on all
+// cores when thread_count is 0. Fails when the tree is not frozen.
+bool quad_tree_query_batch(const QuadTree* tree, const QuadTreeQuery* queries, size_t count, QuadTreeBatchResults* results, size_t thread_count);
+void destroy_quad_tree_batch_results(QuadTreeBatchResults* results);
+// Reports each pair of points at most radius apart once. Pairs of nodes are
+// walked together and dropped as soon as their boxes are further apart than
+// radius. Return false when the visitor stopped the join early.
+bool quad_tree_pairs_within(const QuadTree* tree, float radius, QuadTreePairVisitor visitor, void* context);
+// Pairs one point of a with one point of b, a's point first.
+bool quad_tree_join_within(const QuadTree* a, const QuadTree* b, float radius, QuadTreePairVisitor visitor, void* context);
+// As above, with the work below the top levels spread over thread_count
+// threads, or all cores when 0. The trees must be frozen, and the visitor
+// is called from several threads at once.
+bool quad_tree_pairs_within_parallel(const QuadTree* tree, float radius, QuadTreePairVisitor visitor, void* context, size_t thread_count);
+bool quad_tree_join_within_parallel(const QuadTree* a, const QuadTree* b, float radius, QuadTreePairVisitor visitor, void* context, size_t thread_count);
+// Writes up to k points to out, closest first, and returns how many.
+int quad_tree_knn(const QuadTree* tree, Point point, int k, Point* out);
+bool quad_tree_nearest(const QuadTree* tree, Point point, Point* nearest);
+void quad_tree_get_stats(const QuadTree* tree, QuadTreeStats* stats);
+// Range queries, counts, cursors and knn add to counters kept per thread,
+// so a query's cost is what it added since the last reset on its thread.
+void quad_tree_reset_query_metrics(void);
+void quad_tree_get_query_metrics(QuadTreeQueryMetrics* metrics);
 void print_quad_tree(const QuadTree* tree, int level);
\ No newline at end of file
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+typedef struct RwLock {
+    atomic_uint state;
+} RwLock;
+
+void initialize_rw_lock(RwLock* lock);
+void rw_lock_acquire_read(RwLock* lock);
+void rw_lock_release_read(RwLock* lock);
+void rw_lock_acquire_write(RwLock* lock);
+void rw_lock_release_write(RwLock* lock);
@@ -0,0 +1,123 @@
+#include "concurrent_hash_table.h"
+#include "hash_table.h"
+#include "rw_lock.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE_SIZE 64
+
+// Each segment is an ordinary Robin Hood HashTable behind its own
+// reader/writer lock. Readers of a segment run in parallel; a writer only
+// blocks the segment it touches.
+struct ConcurrentHashTableSegment {
+    RwLock lock;
+    HashTable table;
+    // Keeps neighbouring segments' locks off each other's cache lines.
+    char padding[CACHE_LINE_SIZE];
+};
+
+static ConcurrentHashTableSegment* get_segment(const ConcurrentHashTable* table, uint64_t key) {
+    // Fibonacci hashing on the top bits; the segment's own table hashes the
+    // key again with XXH3 for the slot, so the two choices stay independent.
+    size_t index = (size_t)((key * 0x9E3779B97F4A7C15ull) >> table->segment_shift);
+    assert(index < table->segment_count);
+    return &table->segments[index];
+}
+
+void initialize_concurrent_hash_table(ConcurrentHashTable* table, size_t segment_count) {
+    assert(table != NULL);
+
+    if (segment_count == 0)
+        segment_count = CONCURRENT_HASH_TABLE_DEFAULT_SEGMENTS;
+
+    unsigned bits = 1;
+    while (((size_t)1 << bits) < segment_count) {
+        ++bits;
+    }
+
+    memset(table, 0, sizeof(ConcurrentHashTable));
+    table->segment_count = (size_t)1 << bits;
+    table->segment_shift = 64 - bits;
+    table->segments = (ConcurrentHashTableSegment*)calloc(table->segment_count, sizeof(ConcurrentHashTableSegment));
+    assert(table->segments != NULL);
+
+    for (size_t i = 0; i < table->segment_count; i++) {
+        initialize_rw_lock(&table->segments[i].lock);
+        initialize_hash_table(&table->segments[i].table);
+    }
+}
+
+void destroy_concurrent_hash_table(ConcurrentHashTable* table) {
+    assert(table != NULL);
+    if (table->segments != NULL) {
+        for (size_t i = 0; i < table->segment_count; i++) {
+            destroy_hash_table(&table->segments[i].table);
+        }
+        free(table->segments);
+    }
+    memset(table, 0, sizeof(ConcurrentHashTable));
+}
+
+size_t concurrent_hash_table_count(const ConcurrentHashTable* table) {
+    assert(table != NULL);
+
+    size_t count = 0;
+    for (size_t i = 0; i < table->segment_count; i++) {
+        ConcurrentHashTableSegment* segment = &table->segments[i];
+        rw_lock_acquire_read(&segment->lock);
+        count += segment->table.count;
+        rw_lock_release_read(&segment->lock);
+    }
+    return count;
+}
+
+bool concurrent_hash_table_contains_key(const ConcurrentHashTable* table, uint64_t key) {
+    assert(table != NULL);
+
+    ConcurrentHashTableSegment* segment = get_segment(table, key);
+    rw_lock_acquire_read(&segment->lock);
+    bool result = hash_table_contains_key(&segment->table, key);
+    rw_lock_release_read(&segment->lock);
+    return result;
+}
+
+bool concurrent_hash_table_insert(ConcurrentHashTable* table, uint64_t key, uint32_t value) {
+    assert(table != NULL);
+
+    ConcurrentHashTableSegment* segment = get_segment(table, key);
+    rw_lock_acquire_write(&segment->lock);
+    bool result = hash_table_insert(&segment->table, key, value);
+    rw_lock_release_write(&segment->lock);
+    return result;
+}
+
+bool concurrent_hash_table_delete_entry(ConcurrentHashTable* table, uint64_t key) {
+    assert(table != NULL);
+
+    ConcurrentHashTableSegment* segment = get_segment(table, key);
+    rw_lock_acquire_write(&segment->lock);
+    bool result = hash_table_delete_entry(&segment->table, key);
+    rw_lock_release_write(&segment->lock);
+    return result;
+}
+
+// Copies the value out; a pointer into the segment would not survive a
+// concurrent resize. hash_table_get_entry never modifies the table, so it
+// is safe under the read lock.
+bool concurrent_hash_table_get_entry(const ConcurrentHashTable* table, uint64_t key, uint32_t* value) {
+    assert(table != NULL);
+
+    ConcurrentHashTableSegment* segment = get_segment(table, key);
+    rw_lock_acquire_read(&segment->lock);
+    uint32_t* entry = hash_table_get_entry(&segment->table, key);
+    bool found = entry != NULL;
+    if (found && value != NULL)
+        *value = *entry;
+    rw_lock_release_read(&segment->lock);
+    return found;
+}
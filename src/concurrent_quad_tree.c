@@ -0,0 +1,211 @@
+#include "concurrent_quad_tree.h"
+#include "quad_tree.h"
+#include "rw_lock.h"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE_SIZE 64
+
+// Each cell is an ordinary QuadTree behind its own reader/writer lock.
+// Subdividing and collapsing only ever happen inside one cell's tree under
+// its write lock, so readers of that cell never see a half-merged node.
+struct ConcurrentQuadTreeCell {
+    RwLock lock;
+    QuadTree* tree;
+    // Keeps neighbouring cells' locks off each other's cache lines.
+    char padding[CACHE_LINE_SIZE];
+};
+
+// Index of the cell whose edges contain value, clamping values outside the
+// bounds to the first or last cell. The estimate can be off by one from
+// rounding, which the two loops correct.
+static size_t cell_index_along(const float* edges, size_t grid_size, float value) {
+    float extent = edges[grid_size] - edges[0];
+    float position = (value - edges[0]) / extent * (float)grid_size;
+    size_t index = position <= 0.0f ? 0 : position >= (float)grid_size ? grid_size - 1 : (size_t)position;
+    while (index > 0 && value < edges[index]) {
+        --index;
+    }
+    while (index + 1 < grid_size && value >= edges[index + 1]) {
+        ++index;
+    }
+    return index;
+}
+
+static ConcurrentQuadTreeCell* get_cell(const ConcurrentQuadTree* tree, Point point) {
+    if (!is_point_inside_rect(tree->bounds, point))
+        return NULL;
+
+    size_t column = cell_index_along(tree->x_edges, tree->grid_size, point.x);
+    size_t row = cell_index_along(tree->y_edges, tree->grid_size, point.y);
+    return &tree->cells[row * tree->grid_size + column];
+}
+
+static void fill_edges(float* edges, size_t grid_size, float center, float half_size) {
+    float min = center - half_size;
+    float max = center + half_size;
+    for (size_t i = 0; i <= grid_size; i++) {
+        edges[i] = min + (max - min) * (float)i / (float)grid_size;
+    }
+    edges[grid_size] = max;
+}
+
+// Center and half size do not reproduce the edges exactly, so each cell's
+// tree gets a few ulps of slack to accept every point routed to it.
+static Rect cell_bounds(float min_x, float max_x, float min_y, float max_y) {
+    float slack_x = (fabsf(min_x) + fabsf(max_x)) * FLT_EPSILON;
+    float slack_y = (fabsf(min_y) + fabsf(max_y)) * FLT_EPSILON;
+    return create_rect((min_x + max_x) * 0.5f, (min_y + max_y) * 0.5f, (max_x - min_x) * 0.5f + slack_x, (max_y - min_y) * 0.5f + slack_y);
+}
+
+void initialize_concurrent_quad_tree(ConcurrentQuadTree* tree, Rect bounds, size_t grid_size) {
+    assert(tree != NULL);
+
+    if (grid_size == 0)
+        grid_size = CONCURRENT_QUAD_TREE_DEFAULT_GRID_SIZE;
+
+    memset(tree, 0, sizeof(ConcurrentQuadTree));
+    tree->bounds = bounds;
+    tree->grid_size = grid_size;
+    tree->x_edges = (float*)malloc((grid_size + 1) * sizeof(float));
+    tree->y_edges = (float*)malloc((grid_size + 1) * sizeof(float));
+    tree->cells = (ConcurrentQuadTreeCell*)calloc(grid_size * grid_size, sizeof(ConcurrentQuadTreeCell));
+    assert(tree->x_edges != NULL && tree->y_edges != NULL && tree->cells != NULL);
+
+    fill_edges(tree->x_edges, grid_size, bounds.center.x, bounds.half_width);
+    fill_edges(tree->y_edges, grid_size, bounds.center.y, bounds.half_height);
+    for (size_t row = 0; row < grid_size; row++) {
+        for (size_t column = 0; column < grid_size; column++) {
+            ConcurrentQuadTreeCell* cell = &tree->cells[row * grid_size + column];
+            initialize_rw_lock(&cell->lock);
+            cell->tree = create_new_tree(cell_bounds(tree->x_edges[column], tree->x_edges[column + 1], tree->y_edges[row], tree->y_edges[row + 1]));
+        }
+    }
+}
+
+void destroy_concurrent_quad_tree(ConcurrentQuadTree* tree) {
+    assert(tree != NULL);
+    if (tree->cells != NULL) {
+        for (size_t i = 0; i < tree->grid_size * tree->grid_size; i++) {
+            free_quad_tree(tree->cells[i].tree);
+        }
+        free(tree->cells);
+    }
+    free(tree->y_edges);
+    free(tree->x_edges);
+    memset(tree, 0, sizeof(ConcurrentQuadTree));
+}
+
+size_t concurrent_quad_tree_count(const ConcurrentQuadTree* tree) {
+    assert(tree != NULL);
+
+    size_t count = 0;
+    for (size_t i = 0; i < tree->grid_size * tree->grid_size; i++) {
+        ConcurrentQuadTreeCell* cell = &tree->cells[i];
+        rw_lock_acquire_read(&cell->lock);
+        count += cell->tree->nodes[0].count;
+        rw_lock_release_read(&cell->lock);
+    }
+    return count;
+}
+
+bool concurrent_quad_tree_insert_point(ConcurrentQuadTree* tree, Point point) {
+    assert(tree != NULL);
+
+    ConcurrentQuadTreeCell* cell = get_cell(tree, point);
+    if (cell == NULL)
+        return false;
+    rw_lock_acquire_write(&cell->lock);
+    bool result = insert_point_into_quadtree(cell->tree, point);
+    rw_lock_release_write(&cell->lock);
+    return result;
+}
+
+bool concurrent_quad_tree_remove_point(ConcurrentQuadTree* tree, Point point) {
+    assert(tree != NULL);
+
+    ConcurrentQuadTreeCell* cell = get_cell(tree, point);
+    if (cell == NULL)
+        return false;
+    rw_lock_acquire_write(&cell->lock);
+    bool result = remove_point_from_quad_tree(cell->tree, point);
+    rw_lock_release_write(&cell->lock);
+    return result;
+}
+
+// Range of cells overlapped by the box from min to max, which must overlap
+// the bounds.
+static void cells_overlapping(const ConcurrentQuadTree* tree, Point min, Point max, size_t* first_column, size_t* last_column, size_t* first_row, size_t* last_row) {
+    *first_column = cell_index_along(tree->x_edges, tree->grid_size, min.x);
+    *last_column = cell_index_along(tree->x_edges, tree->grid_size, max.x);
+    *first_row = cell_index_along(tree->y_edges, tree->grid_size, min.y);
+    *last_row = cell_index_along(tree->y_edges, tree->grid_size, max.y);
+}
+
+void concurrent_quad_tree_search_rect(const ConcurrentQuadTree* tree, Rect range, Point* found, int* found_count, int max_count) {
+    assert(tree != NULL);
+    if (!rects_intersect(tree->bounds, range))
+        return;
+
+    size_t first_column, last_column, first_row, last_row;
+    Point min = {range.center.x - range.half_width, range.center.y - range.half_height};
+    Point max = {range.center.x + range.half_width, range.center.y + range.half_height};
+    cells_overlapping(tree, min, max, &first_column, &last_column, &first_row, &last_row);
+
+    for (size_t row = first_row; row <= last_row && *found_count < max_count; row++) {
+        for (size_t column = first_column; column <= last_column && *found_count < max_count; column++) {
+            ConcurrentQuadTreeCell* cell = &tree->cells[row * tree->grid_size + column];
+            rw_lock_acquire_read(&cell->lock);
+            search_space_in_tree(cell->tree, range, found, found_count, max_count);
+            rw_lock_release_read(&cell->lock);
+        }
+    }
+}
+
+void concurrent_quad_tree_search_circle(const ConcurrentQuadTree* tree, Circle range, Point* found, int* found_count, int max_count) {
+    assert(tree != NULL);
+    if (!circle_rect_intersect(range, tree->bounds))
+        return;
+
+    size_t first_column, last_column, first_row, last_row;
+    Point min = {range.center.x - range.radius, range.center.y - range.radius};
+    Point max = {range.center.x + range.radius, range.center.y + range.radius};
+    cells_overlapping(tree, min, max, &first_column, &last_column, &first_row, &last_row);
+
+    for (size_t row = first_row; row <= last_row && *found_count < max_count; row++) {
+        for (size_t column = first_column; column <= last_column && *found_count < max_count; column++) {
+            ConcurrentQuadTreeCell* cell = &tree->cells[row * tree->grid_size + column];
+            rw_lock_acquire_read(&cell->lock);
+            search_circle_in_tree(cell->tree, range, found, found_count, max_count);
+            rw_lock_release_read(&cell->lock);
+        }
+    }
+}
+
+size_t concurrent_quad_tree_count_in_rect(const ConcurrentQuadTree* tree, Rect range) {
+    assert(tree != NULL);
+    if (!rects_intersect(tree->bounds, range))
+        return 0;
+
+    size_t first_column, last_column, first_row, last_row;
+    Point min = {range.center.x - range.half_width, range.center.y - range.half_height};
+    Point max = {range.center.x + range.half_width, range.center.y + range.half_height};
+    cells_overlapping(tree, min, max, &first_column, &last_column, &first_row, &last_row);
+
+    size_t count = 0;
+    for (size_t row = first_row; row <= last_row; row++) {
+        for (size_t column = first_column; column <= last_column; column++) {
+            ConcurrentQuadTreeCell* cell = &tree->cells[row * tree->grid_size + column];
+            rw_lock_acquire_read(&cell->lock);
+            count += quad_tree_count_in_rect(cell->tree, range);
+            rw_lock_release_read(&cell->lock);
+        }
+    }
+    return count;
+}
@@ -0,0 +1,90 @@
+#include "file_mapping.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+bool open_file_mapping(FileMapping* mapping, const char* path, bool writable) {
+    assert(mapping != NULL && path != NULL);
+    memset(mapping, 0, sizeof(FileMapping));
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE file_mapping = CreateFileMappingA(file, NULL, writable ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (file_mapping == NULL)
+        return false;
+
+    // The view keeps the mapping object alive after its handle is closed.
+    void* data = MapViewOfFile(file_mapping, writable ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(file_mapping);
+    if (data == NULL)
+        return false;
+
+    mapping->data = data;
+    mapping->size = (size_t)file_size.QuadPart;
+    return true;
+}
+
+void close_file_mapping(FileMapping* mapping) {
+    assert(mapping != NULL);
+    if (mapping->data != NULL)
+        UnmapViewOfFile(mapping->data);
+    memset(mapping, 0, sizeof(FileMapping));
+}
+
+#else
+
+bool open_file_mapping(FileMapping* mapping, const char* path, bool writable) {
+    assert(mapping != NULL && path != NULL);
+    memset(mapping, 0, sizeof(FileMapping));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    int protection = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void* data = mmap(NULL, (size_t)file_stat.st_size, protection, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    mapping->data = data;
+    mapping->size = (size_t)file_stat.st_size;
+    return true;
+}
+
+void close_file_mapping(FileMapping* mapping) {
+    assert(mapping != NULL);
+    if (mapping->data != NULL)
+        munmap(mapping->data, mapping->size);
+    memset(mapping, 0, sizeof(FileMapping));
+}
+
+#endif
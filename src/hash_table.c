@@ -1,29 +1,179 @@
 #include "hash_table.h"
+#include "file_mapping.h"
 #include "list_utilities.h"
 
 #include <assert.h>
+#include <inttypes.h>
+#include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 #include <time.h>
 #include <stdbool.h>
 
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HASH_TABLE_USE_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(address) __builtin_prefetch(address)
+#elif defined(HASH_TABLE_USE_SSE2)
+#define PREFETCH(address) _mm_prefetch((const char*)(address), _MM_HINT_T0)
+#else
+#define PREFETCH(address) ((void)(address))
+#endif
+
 #define INITIAL_CAPACITY 1024
+#define BATCH_SIZE       32
+#define MIGRATION_STEP   64
+
+#define BUILD_MIN_ENTRIES_PER_THREAD (1 << 14)
+#define BUILD_REGIONS_PER_THREAD     8
+#define BUILD_MIN_REGION_SLOTS       4096
+
+// Logging compiles out of release builds unless explicitly requested.
+#if !defined(NDEBUG) || defined(HASH_TABLE_ENABLE_LOGGING)
+#define HASH_TABLE_LOG(...) hash_table_log(__VA_ARGS__)
+#else
+#define HASH_TABLE_LOG(...) ((void)0)
+#endif
+
+#if defined(HASH_TABLE_ENABLE_STATS)
+#define STATS_START_TIMER(name)              uint64_t name = now_nanoseconds()
+#define STATS_ADD_RESIZE_TIME(table, start)  ((table)->resize_nanoseconds += now_nanoseconds() - (start))
+#define STATS_COUNT_RESIZE(table)            (++(table)->resize_count)
+#else
+#define STATS_START_TIMER(name)              ((void)0)
+#define STATS_ADD_RESIZE_TIME(table, start)  ((void)0)
+#define STATS_COUNT_RESIZE(table)            ((void)0)
+#endif
+
+#define SNAPSHOT_MAGIC       "HTSNAP\0"
+#define SNAPSHOT_VERSION     1
+#define SNAPSHOT_BYTE_ORDER  0x01020304u
+#define SNAPSHOT_HEADER_SIZE 64
+
+// Robin Hood probing: each slot has one metadata byte, 0 marks an empty slot
+// and anything else is an occupied slot whose probe distance is (metadata - 1).
+#define METADATA_EMPTY              0
+#define METADATA_MAX_PROBE_DISTANCE 253
+// Only used in the old slots of an incremental resize, for entries that
+// have already been migrated or deleted.
+#define METADATA_DELETED            0xFF
 
-typedef enum NodeStatus {
-    NODE_STATUS_EMPTY,
-    NODE_STATUS_DELETED,
-    NODE_STATUS_OCCUPIED,
-} NodeStatus;
+// Group probing reuses the metadata array as control bytes. Full slots keep
+// the top 7 bits of the hash with the high bit set.
+#define CONTROL_EMPTY   0x00
+#define CONTROL_DELETED 0x01
+#define CONTROL_FULL    0x80
+#define GROUP_WIDTH     16
 
-struct Node {
-    NodeStatus status;
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t probing;
+    uint32_t reserved;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t nodes_visited;
+    uint64_t seed;
+} SnapshotHeader;
+
+typedef enum InsertionResult {
+    INSERTION_ADDED,
+    INSERTION_ADDED_OVER_DELETED,
+    INSERTION_UPDATED,
+    INSERTION_OVERFLOW,
+} InsertionResult;
+
+typedef struct BuildEntry {
     uint64_t key;
-    size_t probe_distance;
+    uint64_t hash;
     uint32_t value;
-};
+} BuildEntry;
+
+// Entries whose probe run would cross the end of their region. Every key
+// lives either in the region's slots or here, never both.
+typedef struct BuildRegion {
+    BuildEntry* overflow;
+    size_t overflow_count;
+    size_t overflow_capacity;
+    size_t added_count;
+} BuildRegion;
+
+typedef struct BuildContext {
+    HashTableSlots* slots;
+    const uint64_t* keys;
+    const uint32_t* values;
+    size_t count;
+    XXH64_hash_t seed;
+    size_t thread_count;
+    size_t region_count;
+    unsigned region_shift;
+    // [thread][region] counts, turned into scatter offsets before phase two.
+    size_t* region_offsets;
+    // Start of each region's entries, plus one past the last.
+    size_t* region_starts;
+    BuildEntry* entries;
+    BuildRegion* regions;
+    atomic_size_t next_region;
+} BuildContext;
+
+typedef struct BuildWorker {
+    BuildContext* context;
+    size_t thread_index;
+} BuildWorker;
+
+static HashTableLogHook log_hook = NULL;
+static void* log_hook_context = NULL;
+
+#if !defined(NDEBUG) || defined(HASH_TABLE_ENABLE_LOGGING)
+static void hash_table_log(const char* format, ...) {
+    if (log_hook == NULL)
+        return;
+
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    log_hook(message, log_hook_context);
+}
+#endif
+
+#if defined(HASH_TABLE_ENABLE_STATS)
+static uint64_t now_nanoseconds() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+static inline uint8_t metadata_from_probe_distance(size_t probe_distance) {
+    assert(probe_distance <= METADATA_MAX_PROBE_DISTANCE);
+    return (uint8_t)(probe_distance + 1);
+}
+
+static inline size_t probe_distance_from_metadata(uint8_t metadata) {
+    assert(metadata != METADATA_EMPTY);
+    return (size_t)metadata - 1;
+}
 
 static XXH64_hash_t generate_random_seed() {
     uint64_t t = (uint64_t)time(NULL);
@@ -35,166 +185,1019 @@ static uint64_t hash_key(uint64_t key, XXH64_hash_t seed) {
     return XXH3_64bits_withSeed(&key, sizeof(key), seed);
 }
 
-static size_t get_hash_index(const HashTable* table, uint64_t key) {
-    assert(table != NULL);
-    assert(table->nodes != NULL);
+static size_t get_hash_index(const HashTableSlots* slots, uint64_t hash) {
+    assert(slots != NULL);
+    assert(slots->metadata != NULL);
 
-    uint64_t hash = hash_key(key, table->seed);
-    return (size_t)(hash % table->capacity);
+    return (size_t)(hash & (slots->capacity - 1));
+}
+
+static size_t round_up_to_power_of_two(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+static size_t slots_size_in_bytes(size_t capacity) {
+    return capacity * (sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint8_t));
+}
+
+static HashTableSlots allocate_slots(size_t capacity) {
+    assert((capacity & (capacity - 1)) == 0);
+
+    // Keys, values and metadata share one allocation, in that order, so the
+    // 8-byte keys stay aligned and the whole table is released with one free.
+    uint8_t* block = (uint8_t*)calloc(1, slots_size_in_bytes(capacity));
+    assert(block != NULL);
+
+    HashTableSlots slots = {
+        .capacity = capacity,
+        .keys = (uint64_t*)block,
+        .values = (uint32_t*)(block + capacity * sizeof(uint64_t)),
+        .metadata = block + capacity * (sizeof(uint64_t) + sizeof(uint32_t)),
+    };
+    return slots;
+}
+
+static void free_slots(HashTableSlots* slots) {
+    free(slots->keys);
+    memset(slots, 0, sizeof(HashTableSlots));
+}
+
+static bool is_mapped_slots(const HashTable* table, const HashTableSlots* slots) {
+    return table->mapping.data != NULL && (uint8_t*)slots->keys == (uint8_t*)table->mapping.data + SNAPSHOT_HEADER_SIZE;
+}
+
+static void release_slots(HashTable* table, HashTableSlots* slots) {
+    if (is_mapped_slots(table, slots)) {
+        close_file_mapping(&table->mapping);
+        memset(slots, 0, sizeof(HashTableSlots));
+    }
+    else {
+        free_slots(slots);
+    }
+}
+
+// Copies a mapped snapshot into heap memory before its first structural
+// change. Read-only tables refuse the change instead.
+static bool ensure_writable(HashTable* table) {
+    if (table->read_only)
+        return false;
+    if (!is_mapped_slots(table, &table->slots))
+        return true;
+
+    HashTableSlots copy = allocate_slots(table->slots.capacity);
+    memcpy(copy.keys, table->slots.keys, table->slots.capacity * sizeof(uint64_t));
+    memcpy(copy.values, table->slots.values, table->slots.capacity * sizeof(uint32_t));
+    memcpy(copy.metadata, table->slots.metadata, table->slots.capacity * sizeof(uint8_t));
+    release_slots(table, &table->slots);
+    table->slots = copy;
+    return true;
 }
 
-static bool search_node_index(const HashTable* table, uint64_t key, size_t* index) {
-    size_t hash_index = get_hash_index(table, key);
-    size_t probing_distance = 0;
+static bool search_node_index(const HashTableSlots* slots, uint64_t key, uint64_t hash, size_t* index) {
+    size_t mask = slots->capacity - 1;
+    size_t hash_index = get_hash_index(slots, hash);
 
     bool found = false;
-    while (probing_distance < table->nodes_visited) {
-        Node* node = &table->nodes[hash_index];
+    for (size_t probing_distance = 0; probing_distance <= METADATA_MAX_PROBE_DISTANCE; probing_distance++) {
+        uint8_t metadata = slots->metadata[hash_index];
 
-        if (node->status == NODE_STATUS_EMPTY)
+        // Robin Hood ordering: once we reach a slot closer to its home than we
+        // are to ours, the key cannot be further along.
+        if (metadata == METADATA_EMPTY || probe_distance_from_metadata(metadata) < probing_distance)
             break;
 
-        if (node->status == NODE_STATUS_OCCUPIED && node->key == key) {
+        if (slots->keys[hash_index] == key) {
             if (index != NULL)
                 *index = hash_index;
             found = true;
             break;
         }
 
-        hash_index = (hash_index + 1) % table->capacity;
-        ++probing_distance;
+        hash_index = (hash_index + 1) & mask;
     }
     return found;
 }
 
-static bool hash_table_do_insertion(HashTable* table, uint64_t key, uint32_t value, bool reinsert);
+// Inserts or updates *key. On INSERTION_OVERFLOW the entry that could not be
+// placed (not necessarily the one passed in) is returned through key/value.
+static InsertionResult robin_hood_insert(HashTableSlots* slots, uint64_t* key, uint32_t* value, uint64_t hash) {
+    size_t mask = slots->capacity - 1;
+    size_t index = get_hash_index(slots, hash);
 
-static void resize_hash_table(HashTable* table) {
-    Node* old_table = table->nodes;
-    size_t old_capacity = table->capacity;
+    uint64_t carried_key = *key;
+    uint32_t carried_value = *value;
+    size_t probe_distance = 0;
+    bool displaced = false;
 
-    table->capacity += INITIAL_CAPACITY;
-    table->nodes = (Node*)calloc(table->capacity, sizeof(Node));
+    while (probe_distance <= METADATA_MAX_PROBE_DISTANCE) {
+        uint8_t metadata = slots->metadata[index];
+        if (metadata == METADATA_EMPTY) {
+            slots->metadata[index] = metadata_from_probe_distance(probe_distance);
+            slots->keys[index] = carried_key;
+            slots->values[index] = carried_value;
+            return INSERTION_ADDED;
+        }
 
-    for (int i = 0; i < old_capacity; i++) {
-        Node* node = &old_table[i];
-        if (node->status != NODE_STATUS_OCCUPIED)
-            continue;
+        if (!displaced && slots->keys[index] == carried_key) {
+            slots->values[index] = carried_value;
+            return INSERTION_UPDATED;
+        }
+
+        size_t resident_distance = probe_distance_from_metadata(metadata);
+        if (resident_distance < probe_distance) {
+            uint64_t temp_key = slots->keys[index];
+            uint32_t temp_value = slots->values[index];
+            slots->metadata[index] = metadata_from_probe_distance(probe_distance);
+            slots->keys[index] = carried_key;
+            slots->values[index] = carried_value;
 
-        assert(hash_table_do_insertion(table, node->key, node->value, true));
+            carried_key = temp_key;
+            carried_value = temp_value;
+            probe_distance = resident_distance;
+            displaced = true;
+        }
+
+        index = (index + 1) & mask;
+        ++probe_distance;
     }
 
-    free(old_table);
+    *key = carried_key;
+    *value = carried_value;
+    return INSERTION_OVERFLOW;
 }
 
-static bool hash_table_do_insertion(HashTable* table, uint64_t key, uint32_t value, bool reinsert) {
-    if (!reinsert && ((table->count * 2) >= table->capacity)) {
-        fprintf(stderr, "Resizing table\n");
-        resize_hash_table(table);
+static inline uint8_t control_from_hash(uint64_t hash) {
+    return (uint8_t)(CONTROL_FULL | (hash >> 57));
+}
+
+static inline unsigned lowest_set_bit(uint32_t mask) {
+    assert(mask != 0);
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+// Returns a bitmask with bit i set when control[i] == byte.
+static inline uint32_t group_match(const uint8_t* control, uint8_t byte) {
+#if defined(HASH_TABLE_USE_SSE2)
+    __m128i group = _mm_loadu_si128((const __m128i*)control);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(control[i] == byte) << i;
     }
+    return mask;
+#endif
+}
 
-    size_t index = get_hash_index(table, key);
+static inline uint32_t group_match_available(const uint8_t* control) {
+#if defined(HASH_TABLE_USE_SSE2)
+    __m128i group = _mm_loadu_si128((const __m128i*)control);
+    // Empty and deleted are the only control bytes without the high bit.
+    return (uint32_t)_mm_movemask_epi8(_mm_xor_si128(group, _mm_set1_epi8((char)0x80)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        mask |= (uint32_t)((control[i] & CONTROL_FULL) == 0) << i;
+    }
+    return mask;
+#endif
+}
 
-    Node node_to_add = {
-        .status = NODE_STATUS_OCCUPIED,
-        .key = key,
-        .probe_distance = 0,
-        .value = value,
-    };
+// Groups are probed triangularly (g, g + 1, g + 3, ...), which visits every
+// group once when the group count is a power of two.
+static bool group_search_node_index(const HashTableSlots* slots, uint64_t key, uint64_t hash, size_t* index) {
+    size_t group_mask = slots->capacity / GROUP_WIDTH - 1;
+    size_t group = get_hash_index(slots, hash) / GROUP_WIDTH;
+    uint8_t control_byte = control_from_hash(hash);
+
+    for (size_t step = 0; step <= group_mask; step++) {
+        const uint8_t* control = slots->metadata + group * GROUP_WIDTH;
+
+        uint32_t matches = group_match(control, control_byte);
+        while (matches != 0) {
+            size_t slot_index = group * GROUP_WIDTH + lowest_set_bit(matches);
+            if (slots->keys[slot_index] == key) {
+                if (index != NULL)
+                    *index = slot_index;
+                return true;
+            }
+            matches &= matches - 1;
+        }
+
+        if (group_match(control, CONTROL_EMPTY) != 0)
+            break;
+
+        group = (group + step + 1) & group_mask;
+    }
+    return false;
+}
+
+static InsertionResult group_insert(HashTableSlots* slots, uint64_t key, uint32_t value, uint64_t hash) {
+    size_t index;
+    if (group_search_node_index(slots, key, hash, &index)) {
+        slots->values[index] = value;
+        return INSERTION_UPDATED;
+    }
+
+    size_t group_mask = slots->capacity / GROUP_WIDTH - 1;
+    size_t group = get_hash_index(slots, hash) / GROUP_WIDTH;
+
+    for (size_t step = 0; step <= group_mask; step++) {
+        uint32_t available = group_match_available(slots->metadata + group * GROUP_WIDTH);
+        if (available != 0) {
+            index = group * GROUP_WIDTH + lowest_set_bit(available);
+            bool was_deleted = slots->metadata[index] == CONTROL_DELETED;
+            slots->metadata[index] = control_from_hash(hash);
+            slots->keys[index] = key;
+            slots->values[index] = value;
+            return was_deleted ? INSERTION_ADDED_OVER_DELETED : INSERTION_ADDED;
+        }
+
+        group = (group + step + 1) & group_mask;
+    }
+    return INSERTION_OVERFLOW;
+}
 
-    bool success = false;
-    for (int i = 0; i < table->capacity; i++) {
-        size_t probe_index = (index + i) % table->capacity;
-        Node* cursor = &table->nodes[probe_index];
+// Returns true when the slot became empty rather than a tombstone.
+static bool group_remove(HashTableSlots* slots, size_t index) {
+    // A search only stops at a group that has an empty slot, so if this group
+    // already has one the freed slot can be empty too.
+    const uint8_t* control = slots->metadata + (index & ~(size_t)(GROUP_WIDTH - 1));
+    bool becomes_empty = group_match(control, CONTROL_EMPTY) != 0;
+    slots->metadata[index] = becomes_empty ? CONTROL_EMPTY : CONTROL_DELETED;
+    return becomes_empty;
+}
 
-        if (cursor->status != NODE_STATUS_OCCUPIED || cursor->key == key) {
-            if (cursor->status != NODE_STATUS_OCCUPIED && !reinsert)
-                ++table->count;
+static bool find_slot(HashTableProbing probing, const HashTableSlots* slots, uint64_t key, uint64_t hash, size_t* index) {
+    if (probing == HASH_TABLE_PROBING_GROUP)
+        return group_search_node_index(slots, key, hash, index);
+    return search_node_index(slots, key, hash, index);
+}
 
-            if (cursor->status == NODE_STATUS_EMPTY && !reinsert)
-                ++table->nodes_visited;
+static InsertionResult insert_into_slots(HashTableProbing probing, HashTableSlots* slots, uint64_t* key, uint32_t* value, uint64_t hash) {
+    if (probing == HASH_TABLE_PROBING_GROUP)
+        return group_insert(slots, *key, *value, hash);
+    return robin_hood_insert(slots, key, value, hash);
+}
 
-            *cursor = node_to_add;
-            success = true;
+static bool is_slot_occupied(HashTableProbing probing, const HashTableSlots* slots, size_t index) {
+    if (probing == HASH_TABLE_PROBING_GROUP)
+        return (slots->metadata[index] & CONTROL_FULL) != 0;
+    return slots->metadata[index] != METADATA_EMPTY && slots->metadata[index] != METADATA_DELETED;
+}
+
+static bool rehash_slots(HashTableProbing probing, const HashTableSlots* source, HashTableSlots* destination, XXH64_hash_t seed, size_t* rehashed_count) {
+    *rehashed_count = 0;
+    for (size_t i = 0; i < source->capacity; i++) {
+        if (!is_slot_occupied(probing, source, i))
+            continue;
+
+        uint64_t key = source->keys[i];
+        uint32_t value = source->values[i];
+        if (insert_into_slots(probing, destination, &key, &value, hash_key(key, seed)) == INSERTION_OVERFLOW)
+            return false;
+        ++(*rehashed_count);
+    }
+    return true;
+}
+
+static bool is_resizing(const HashTable* table) {
+    return table->old_slots.capacity != 0;
+}
+
+// Same as search_node_index, but steps over entries that were already
+// migrated out of (or deleted from) the old slots.
+static bool search_draining_node_index(const HashTableSlots* slots, uint64_t key, uint64_t hash, size_t* index) {
+    size_t mask = slots->capacity - 1;
+    size_t hash_index = get_hash_index(slots, hash);
+
+    for (size_t probing_distance = 0; probing_distance <= METADATA_MAX_PROBE_DISTANCE; probing_distance++) {
+        uint8_t metadata = slots->metadata[hash_index];
+        if (metadata == METADATA_EMPTY)
             break;
+
+        if (metadata != METADATA_DELETED) {
+            if (probe_distance_from_metadata(metadata) < probing_distance)
+                break;
+
+            if (slots->keys[hash_index] == key) {
+                *index = hash_index;
+                return true;
+            }
         }
 
-        if (cursor->status == NODE_STATUS_OCCUPIED && node_to_add.probe_distance > cursor->probe_distance) {
-            Node temp = *cursor;
-            *cursor = node_to_add;
-            node_to_add = temp;
+        hash_index = (hash_index + 1) & mask;
+    }
+    return false;
+}
+
+static bool find_old_slot(const HashTable* table, uint64_t key, uint64_t hash, size_t* index) {
+    if (!is_resizing(table))
+        return false;
+    if (table->probing == HASH_TABLE_PROBING_GROUP)
+        return group_search_node_index(&table->old_slots, key, hash, index);
+    return search_draining_node_index(&table->old_slots, key, hash, index);
+}
+
+static void mark_old_slot_deleted(HashTable* table, size_t index) {
+    table->old_slots.metadata[index] = table->probing == HASH_TABLE_PROBING_GROUP ? CONTROL_DELETED : METADATA_DELETED;
+}
+
+// Rehashing into the same capacity is allowed; group probing uses it to
+// clear out tombstones.
+static void resize_hash_table(HashTable* table, size_t new_capacity) {
+    assert(new_capacity >= table->slots.capacity);
+    assert((new_capacity & (new_capacity - 1)) == 0);
+
+    STATS_START_TIMER(start);
+    STATS_COUNT_RESIZE(table);
+    HASH_TABLE_LOG("Resizing table from %zu to %zu slots", table->slots.capacity, new_capacity);
+
+    HashTableSlots new_slots = allocate_slots(new_capacity);
+
+    // A probe run longer than the metadata byte can hold needs more room.
+    size_t rehashed_count;
+    while (!rehash_slots(table->probing, &table->slots, &new_slots, table->seed, &rehashed_count)) {
+        new_capacity *= 2;
+        free_slots(&new_slots);
+        new_slots = allocate_slots(new_capacity);
+    }
+
+    release_slots(table, &table->slots);
+    table->slots = new_slots;
+    table->nodes_visited = rehashed_count;
+    STATS_ADD_RESIZE_TIME(table, start);
+}
+
+// Puts an entry into the current slots without any load factor check.
+static InsertionResult place_entry(HashTable* table, uint64_t key, uint32_t value, uint64_t hash) {
+    InsertionResult result = insert_into_slots(table->probing, &table->slots, &key, &value, hash);
+    while (result == INSERTION_OVERFLOW) {
+        resize_hash_table(table, table->slots.capacity * 2);
+        result = insert_into_slots(table->probing, &table->slots, &key, &value, hash_key(key, table->seed));
+    }
+
+    if (result == INSERTION_ADDED)
+        ++table->nodes_visited;
+    return result;
+}
+
+static void begin_incremental_resize(HashTable* table, size_t new_capacity) {
+    assert(!is_resizing(table));
+
+    STATS_START_TIMER(start);
+    STATS_COUNT_RESIZE(table);
+    HASH_TABLE_LOG("Starting incremental resize from %zu to %zu slots", table->slots.capacity, new_capacity);
+
+    table->old_slots = table->slots;
+    table->slots = allocate_slots(new_capacity);
+    table->nodes_visited = 0;
+    table->migration_index = 0;
+    STATS_ADD_RESIZE_TIME(table, start);
+}
+
+// Moves up to slot_budget old slots into the current slots.
+static void migrate_slots(HashTable* table, size_t slot_budget) {
+    if (!is_resizing(table))
+        return;
+
+    STATS_START_TIMER(start);
+    HashTableSlots* old_slots = &table->old_slots;
+    for (; slot_budget > 0 && table->migration_index < old_slots->capacity; --slot_budget) {
+        size_t index = table->migration_index++;
+        if (!is_slot_occupied(table->probing, old_slots, index))
+            continue;
+
+        uint64_t key = old_slots->keys[index];
+        InsertionResult result = place_entry(table, key, old_slots->values[index], hash_key(key, table->seed));
+        assert(result != INSERTION_UPDATED);
+        (void)result;
+        mark_old_slot_deleted(table, index);
+    }
+
+    if (table->migration_index == old_slots->capacity) {
+        release_slots(table, old_slots);
+        table->migration_index = 0;
+    }
+    STATS_ADD_RESIZE_TIME(table, start);
+}
+
+static void finish_incremental_resize(HashTable* table) {
+    migrate_slots(table, SIZE_MAX);
+}
+
+static bool hash_table_do_insertion(HashTable* table, uint64_t key, uint32_t value, uint64_t hash) {
+    if (!ensure_writable(table))
+        return false;
+
+    // nodes_visited counts every non-empty slot, tombstones included, so it
+    // is what bounds probe lengths for both engines.
+    if ((table->nodes_visited * 2) >= table->slots.capacity) {
+        finish_incremental_resize(table);
+
+        bool mostly_tombstones = (table->count * 4) < table->slots.capacity;
+        size_t new_capacity = mostly_tombstones ? table->slots.capacity : table->slots.capacity * 2;
+        if (table->incremental_resize) {
+            begin_incremental_resize(table, new_capacity);
+        }
+        else {
+            resize_hash_table(table, new_capacity);
         }
-        ++node_to_add.probe_distance;
+    }
 
-        if (node_to_add.probe_distance >= table->capacity)
-            break;
+    if (is_resizing(table)) {
+        migrate_slots(table, MIGRATION_STEP);
+
+        size_t old_index;
+        if (find_old_slot(table, key, hash, &old_index)) {
+            mark_old_slot_deleted(table, old_index);
+            --table->count;
+        }
     }
-    return success;
+
+    if (place_entry(table, key, value, hash) != INSERTION_UPDATED)
+        ++table->count;
+    return true;
+}
+
+void hash_table_set_log_hook(HashTableLogHook hook, void* context) {
+    log_hook = hook;
+    log_hook_context = context;
 }
 
 void initialize_hash_table(HashTable* table) {
+    initialize_hash_table_with_probing(table, HASH_TABLE_PROBING_ROBIN_HOOD);
+}
+
+void initialize_hash_table_with_probing(HashTable* table, HashTableProbing probing) {
     assert(table != NULL);
 
     memset(table, 0, sizeof(HashTable));
     table->seed = generate_random_seed();
-    table->capacity = INITIAL_CAPACITY;
-    table->nodes = (Node*)calloc(table->capacity, sizeof(Node));
+    table->probing = probing;
+    table->slots = allocate_slots(INITIAL_CAPACITY);
 }
 
 void destroy_hash_table(HashTable* table) {
     assert(table != NULL);
-    if (table->nodes != NULL) {
-        free(table->nodes);
+    if (table->slots.keys != NULL) {
+        release_slots(table, &table->slots);
+    }
+    if (table->old_slots.keys != NULL) {
+        release_slots(table, &table->old_slots);
     }
     memset(table, 0, sizeof(HashTable));
 }
 
+void hash_table_set_incremental_resize(HashTable* table, bool enabled) {
+    assert(table != NULL);
+
+    if (!enabled)
+        finish_incremental_resize(table);
+    table->incremental_resize = enabled;
+}
+
+void hash_table_reserve(HashTable* table, size_t count) {
+    assert(table != NULL);
+
+    finish_incremental_resize(table);
+    size_t required_capacity = round_up_to_power_of_two(count * 2);
+    if (required_capacity > table->slots.capacity && ensure_writable(table))
+        resize_hash_table(table, required_capacity);
+}
+
 bool hash_table_contains_key(const HashTable* table, uint64_t key) {
     assert(table != NULL);
-    return search_node_index(table, key, NULL);
+
+    size_t index;
+    uint64_t hash = hash_key(key, table->seed);
+    return find_slot(table->probing, &table->slots, key, hash, NULL) || find_old_slot(table, key, hash, &index);
 }
 
 bool hash_table_insert(HashTable* table, uint64_t key, uint32_t value) {
-    bool result = hash_table_do_insertion(table, key, value, false);
-    assert(result);
+    bool result = hash_table_do_insertion(table, key, value, hash_key(key, table->seed));
+    assert(result || table->read_only);
     return result;
 }
 
-static void do_backwards_shift(HashTable* table, size_t start_index) {
+static void prefetch_home_slots(const HashTable* table, const uint64_t* keys, uint64_t* hashes, size_t count) {
+    const HashTableSlots* slots = &table->slots;
+    for (size_t i = 0; i < count; i++) {
+        hashes[i] = hash_key(keys[i], table->seed);
+
+        size_t index = get_hash_index(slots, hashes[i]);
+        if (table->probing == HASH_TABLE_PROBING_GROUP)
+            index &= ~(size_t)(GROUP_WIDTH - 1);
+        PREFETCH(&slots->metadata[index]);
+        PREFETCH(&slots->keys[index]);
+    }
+}
+
+size_t hash_table_get_entries_batch(const HashTable* table, const uint64_t* keys, size_t count, uint32_t* out_values, bool* out_found) {
+    assert(table != NULL);
+    assert(keys != NULL || count == 0);
+
+    size_t found_count = 0;
+    uint64_t hashes[BATCH_SIZE];
+    for (size_t start = 0; start < count; start += BATCH_SIZE) {
+        size_t batch_count = (count - start) < BATCH_SIZE ? (count - start) : BATCH_SIZE;
+        prefetch_home_slots(table, keys + start, hashes, batch_count);
+
+        for (size_t i = 0; i < batch_count; i++) {
+            size_t index;
+            bool found = find_slot(table->probing, &table->slots, keys[start + i], hashes[i], &index);
+            if (found) {
+                ++found_count;
+                if (out_values != NULL)
+                    out_values[start + i] = table->slots.values[index];
+            }
+            else if (find_old_slot(table, keys[start + i], hashes[i], &index)) {
+                found = true;
+                ++found_count;
+                if (out_values != NULL)
+                    out_values[start + i] = table->old_slots.values[index];
+            }
+            if (out_found != NULL)
+                out_found[start + i] = found;
+        }
+    }
+    return found_count;
+}
+
+bool hash_table_insert_batch(HashTable* table, const uint64_t* keys, const uint32_t* values, size_t count) {
+    assert(table != NULL);
+    assert((keys != NULL && values != NULL) || count == 0);
+
+    hash_table_reserve(table, table->count + count);
+
+    bool success = true;
+    uint64_t hashes[BATCH_SIZE];
+    for (size_t start = 0; start < count; start += BATCH_SIZE) {
+        size_t batch_count = (count - start) < BATCH_SIZE ? (count - start) : BATCH_SIZE;
+        prefetch_home_slots(table, keys + start, hashes, batch_count);
+
+        for (size_t i = 0; i < batch_count; i++) {
+            success &= hash_table_do_insertion(table, keys[start + i], values[start + i], hashes[i]);
+        }
+    }
+    return success;
+}
+
+static size_t available_thread_count() {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (size_t)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1;
+#endif
+}
+
+static size_t build_region_of(const BuildContext* context, uint64_t hash) {
+    return get_hash_index(context->slots, hash) >> context->region_shift;
+}
+
+static void build_worker_range(const BuildWorker* worker, size_t* begin, size_t* end) {
+    const BuildContext* context = worker->context;
+    *begin = context->count * worker->thread_index / context->thread_count;
+    *end = context->count * (worker->thread_index + 1) / context->thread_count;
+}
+
+// Phase one: histogram of regions over this worker's slice of the input.
+static int build_count_regions(void* arg) {
+    BuildWorker* worker = (BuildWorker*)arg;
+    BuildContext* context = worker->context;
+    size_t* counts = context->region_offsets + worker->thread_index * context->region_count;
+
+    size_t begin, end;
+    build_worker_range(worker, &begin, &end);
+    for (size_t i = begin; i < end; i++) {
+        ++counts[build_region_of(context, hash_key(context->keys[i], context->seed))];
+    }
+    return 0;
+}
+
+// Phase two: stable scatter into region order. Hashing again is cheaper
+// than keeping a second array of hashes around.
+static int build_scatter_entries(void* arg) {
+    BuildWorker* worker = (BuildWorker*)arg;
+    BuildContext* context = worker->context;
+    size_t* offsets = context->region_offsets + worker->thread_index * context->region_count;
+
+    size_t begin, end;
+    build_worker_range(worker, &begin, &end);
+    for (size_t i = begin; i < end; i++) {
+        uint64_t hash = hash_key(context->keys[i], context->seed);
+        context->entries[offsets[build_region_of(context, hash)]++] = (BuildEntry){
+            .key = context->keys[i],
+            .hash = hash,
+            .value = context->values[i],
+        };
+    }
+    return 0;
+}
+
+static bool update_overflow_entry(BuildRegion* region, const BuildEntry* entry) {
+    for (size_t i = 0; i < region->overflow_count; i++) {
+        if (region->overflow[i].key == entry->key) {
+            region->overflow[i].value = entry->value;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void add_overflow_entry(BuildRegion* region, uint64_t key, uint32_t value) {
+    if (region->overflow_count == region->overflow_capacity)
+        increase_list_capacity((void**)&region->overflow, &region->overflow_capacity, sizeof(BuildEntry), region->overflow_capacity + 16);
+    region->overflow[region->overflow_count++] = (BuildEntry){.key = key, .value = value};
+}
+
+// robin_hood_insert that never probes past region_end, so regions can be
+// filled concurrently. Whatever would cross the end goes to the overflow.
+static void build_region_insert(HashTableSlots* slots, size_t region_end, BuildEntry entry, BuildRegion* region) {
+    size_t index = get_hash_index(slots, entry.hash);
+    uint64_t carried_key = entry.key;
+    uint32_t carried_value = entry.value;
+    size_t probe_distance = 0;
+    bool displaced = false;
+
+    while (index < region_end && probe_distance <= METADATA_MAX_PROBE_DISTANCE) {
+        uint8_t metadata = slots->metadata[index];
+        if (metadata == METADATA_EMPTY) {
+            slots->metadata[index] = metadata_from_probe_distance(probe_distance);
+            slots->keys[index] = carried_key;
+            slots->values[index] = carried_value;
+            ++region->added_count;
+            return;
+        }
+
+        if (!displaced && slots->keys[index] == carried_key) {
+            slots->values[index] = carried_value;
+            return;
+        }
+
+        size_t resident_distance = probe_distance_from_metadata(metadata);
+        if (resident_distance < probe_distance) {
+            uint64_t temp_key = slots->keys[index];
+            uint32_t temp_value = slots->values[index];
+            slots->metadata[index] = metadata_from_probe_distance(probe_distance);
+            slots->keys[index] = carried_key;
+            slots->values[index] = carried_value;
+
+            carried_key = temp_key;
+            carried_value = temp_value;
+            probe_distance = resident_distance;
+            displaced = true;
+        }
+
+        ++index;
+        ++probe_distance;
+    }
+
+    ++region->added_count;
+    add_overflow_entry(region, carried_key, carried_value);
+}
+
+// Phase three: workers claim whole regions until none are left.
+static int build_fill_regions(void* arg) {
+    BuildWorker* worker = (BuildWorker*)arg;
+    BuildContext* context = worker->context;
+
+    for (;;) {
+        size_t region_index = atomic_fetch_add(&context->next_region, 1);
+        if (region_index >= context->region_count)
+            break;
+
+        BuildRegion* region = &context->regions[region_index];
+        size_t region_end = (region_index + 1) << context->region_shift;
+        for (size_t i = context->region_starts[region_index]; i < context->region_starts[region_index + 1]; i++) {
+            if (!update_overflow_entry(region, &context->entries[i]))
+                build_region_insert(context->slots, region_end, context->entries[i], region);
+        }
+    }
+    return 0;
+}
+
+// Runs phase on every worker, using the calling thread as worker zero. A
+// worker whose thread cannot be started runs inline instead.
+static void run_build_phase(BuildWorker* workers, thrd_t* threads, bool* started, size_t thread_count, thrd_start_t phase) {
+    for (size_t i = 1; i < thread_count; i++) {
+        started[i] = thrd_create(&threads[i], phase, &workers[i]) == thrd_success;
+        if (!started[i])
+            phase(&workers[i]);
+    }
+    phase(&workers[0]);
+    for (size_t i = 1; i < thread_count; i++) {
+        if (started[i])
+            thrd_join(threads[i], NULL);
+    }
+}
+
+bool hash_table_build_from_arrays(HashTable* table, const uint64_t* keys, const uint32_t* values, size_t count) {
     assert(table != NULL);
+    assert((keys != NULL && values != NULL) || count == 0);
+
+    size_t thread_count = available_thread_count();
+    if (thread_count > count / BUILD_MIN_ENTRIES_PER_THREAD)
+        thread_count = count / BUILD_MIN_ENTRIES_PER_THREAD;
+
+    // Group probing has no ordering to keep per region, and a table that
+    // already has entries needs the regular duplicate handling.
+    if (table->probing == HASH_TABLE_PROBING_GROUP || table->count != 0 || thread_count < 2)
+        return hash_table_insert_batch(table, keys, values, count);
+    if (!ensure_writable(table))
+        return false;
+    finish_incremental_resize(table);
+
+    size_t capacity = round_up_to_power_of_two(count * 2);
+    if (capacity < table->slots.capacity)
+        capacity = table->slots.capacity;
+    HashTableSlots slots = allocate_slots(capacity);
+
+    // Regions are runs of slots sharing a hash prefix, so an entry's region
+    // is known from its home index alone.
+    size_t region_count = round_up_to_power_of_two(thread_count * BUILD_REGIONS_PER_THREAD);
+    while (region_count > 1 && capacity / region_count < BUILD_MIN_REGION_SLOTS) {
+        region_count /= 2;
+    }
+    unsigned region_shift = 0;
+    while ((region_count << region_shift) < capacity) {
+        ++region_shift;
+    }
+
+    HASH_TABLE_LOG("Building table of %zu entries in %zu slots with %zu threads", count, capacity, thread_count);
+
+    BuildContext context = {
+        .slots = &slots,
+        .keys = keys,
+        .values = values,
+        .count = count,
+        .seed = table->seed,
+        .thread_count = thread_count,
+        .region_count = region_count,
+        .region_shift = region_shift,
+        .region_offsets = (size_t*)calloc(thread_count * region_count, sizeof(size_t)),
+        .region_starts = (size_t*)calloc(region_count + 1, sizeof(size_t)),
+        .entries = (BuildEntry*)malloc(count * sizeof(BuildEntry)),
+        .regions = (BuildRegion*)calloc(region_count, sizeof(BuildRegion)),
+    };
+    atomic_init(&context.next_region, 0);
+
+    BuildWorker* workers = (BuildWorker*)calloc(thread_count, sizeof(BuildWorker));
+    thrd_t* threads = (thrd_t*)calloc(thread_count, sizeof(thrd_t));
+    bool* started = (bool*)calloc(thread_count, sizeof(bool));
+    assert(context.region_offsets != NULL && context.region_starts != NULL && context.entries != NULL && context.regions != NULL);
+    assert(workers != NULL && threads != NULL && started != NULL);
+    for (size_t i = 0; i < thread_count; i++) {
+        workers[i] = (BuildWorker){.context = &context, .thread_index = i};
+    }
 
+    run_build_phase(workers, threads, started, thread_count, build_count_regions);
+
+    size_t offset = 0;
+    for (size_t r = 0; r < region_count; r++) {
+        context.region_starts[r] = offset;
+        for (size_t t = 0; t < thread_count; t++) {
+            size_t region_size = context.region_offsets[t * region_count + r];
+            context.region_offsets[t * region_count + r] = offset;
+            offset += region_size;
+        }
+    }
+    context.region_starts[region_count] = offset;
+
+    run_build_phase(workers, threads, started, thread_count, build_scatter_entries);
+    run_build_phase(workers, threads, started, thread_count, build_fill_regions);
+
+    release_slots(table, &table->slots);
+    table->slots = slots;
+    table->count = 0;
+    table->nodes_visited = 0;
+    for (size_t r = 0; r < region_count; r++) {
+        table->count += context.regions[r].added_count;
+        table->nodes_visited += context.regions[r].added_count - context.regions[r].overflow_count;
+    }
+
+    // The overflow keys are unique and absent from the slots, so the regular
+    // insertion path only has to place them.
+    for (size_t r = 0; r < region_count; r++) {
+        BuildRegion* region = &context.regions[r];
+        for (size_t i = 0; i < region->overflow_count; i++) {
+            uint64_t key = region->overflow[i].key;
+            InsertionResult result = place_entry(table, key, region->overflow[i].value, hash_key(key, table->seed));
+            assert(result == INSERTION_ADDED);
+            (void)result;
+        }
+        free(region->overflow);
+    }
+
+    free(started);
+    free(threads);
+    free(workers);
+    free(context.regions);
+    free(context.entries);
+    free(context.region_starts);
+    free(context.region_offsets);
+    return true;
+}
+
+static void do_backwards_shift(HashTableSlots* slots, size_t start_index) {
+    assert(slots != NULL);
+
+    size_t mask = slots->capacity - 1;
     size_t prev = start_index;
-    size_t next = (prev + 1) % table->capacity;
-    while (table->nodes[next].status == NODE_STATUS_OCCUPIED && table->nodes[next].probe_distance > 0) {
-        table->nodes[prev] = table->nodes[next];
-        --table->nodes[prev].probe_distance;
+    size_t next = (prev + 1) & mask;
+    while (slots->metadata[next] != METADATA_EMPTY && probe_distance_from_metadata(slots->metadata[next]) > 0) {
+        slots->keys[prev] = slots->keys[next];
+        slots->values[prev] = slots->values[next];
+        slots->metadata[prev] = slots->metadata[next] - 1;
 
         prev = next;
-        next = (next + 1) % table->capacity;
+        next = (next + 1) & mask;
     }
+    slots->metadata[prev] = METADATA_EMPTY;
 }
 
 bool hash_table_delete_entry(HashTable* table, uint64_t key) {
+    if (!ensure_writable(table))
+        return false;
+
+    migrate_slots(table, MIGRATION_STEP);
+
     size_t index;
-    bool success = search_node_index(table, key, &index);
+    uint64_t hash = hash_key(key, table->seed);
+    bool success = find_slot(table->probing, &table->slots, key, hash, &index);
     if (success) {
-        table->nodes[index].status = NODE_STATUS_DELETED;
         --table->count;
-        do_backwards_shift(table, index);
+        if (table->probing == HASH_TABLE_PROBING_GROUP) {
+            if (group_remove(&table->slots, index))
+                --table->nodes_visited;
+        }
+        else {
+            --table->nodes_visited;
+            do_backwards_shift(&table->slots, index);
+        }
+    }
+    else if (find_old_slot(table, key, hash, &index)) {
+        success = true;
+        --table->count;
+        mark_old_slot_deleted(table, index);
     }
     else {
-        fprintf(stderr, "Error: Cannot find key %zu. Failed to delete\n", key);
+        HASH_TABLE_LOG("Cannot find key %" PRIu64 ". Failed to delete", key);
     }
     return success;
 }
 
 uint32_t* hash_table_get_entry(HashTable* table, uint64_t key) {
     size_t index;
-    bool success = search_node_index(table, key, &index);
+    uint64_t hash = hash_key(key, table->seed);
 
     uint32_t* result = NULL;
-    if (success)
-        result = &table->nodes[index].value;
+    if (find_slot(table->probing, &table->slots, key, hash, &index))
+        result = &table->slots.values[index];
+    else if (find_old_slot(table, key, hash, &index))
+        result = &table->old_slots.values[index];
 
     return result;
 }
+
+bool hash_table_save(HashTable* table, const char* path) {
+    assert(table != NULL && path != NULL);
+
+    finish_incremental_resize(table);
+
+    SnapshotHeader header = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .byte_order = SNAPSHOT_BYTE_ORDER,
+        .probing = (uint32_t)table->probing,
+        .capacity = table->slots.capacity,
+        .count = table->count,
+        .nodes_visited = table->nodes_visited,
+        .seed = table->seed,
+    };
+    uint8_t header_bytes[SNAPSHOT_HEADER_SIZE] = {0};
+    memcpy(header_bytes, &header, sizeof(header));
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+
+    // Same order as allocate_slots, so a mapped file can be used in place.
+    size_t capacity = table->slots.capacity;
+    bool success = fwrite(header_bytes, 1, sizeof(header_bytes), file) == sizeof(header_bytes)
+                   && fwrite(table->slots.keys, sizeof(uint64_t), capacity, file) == capacity
+                   && fwrite(table->slots.values, sizeof(uint32_t), capacity, file) == capacity
+                   && fwrite(table->slots.metadata, sizeof(uint8_t), capacity, file) == capacity;
+    success &= fclose(file) == 0;
+    return success;
+}
+
+bool hash_table_open_mapped(HashTable* table, const char* path, HashTableMapMode mode) {
+    assert(table != NULL && path != NULL);
+    memset(table, 0, sizeof(HashTable));
+
+    FileMapping mapping;
+    if (!open_file_mapping(&mapping, path, mode == HASH_TABLE_MAP_COPY_ON_WRITE))
+        return false;
+
+    SnapshotHeader header;
+    bool valid = mapping.size >= SNAPSHOT_HEADER_SIZE;
+    if (valid) {
+        memcpy(&header, mapping.data, sizeof(header));
+        valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0
+                && header.version == SNAPSHOT_VERSION
+                && header.byte_order == SNAPSHOT_BYTE_ORDER
+                && header.probing <= HASH_TABLE_PROBING_GROUP
+                && header.capacity >= GROUP_WIDTH
+                && (header.capacity & (header.capacity - 1)) == 0
+                && mapping.size == SNAPSHOT_HEADER_SIZE + slots_size_in_bytes((size_t)header.capacity);
+    }
+    if (!valid) {
+        HASH_TABLE_LOG("%s is not a valid hash table snapshot", path);
+        close_file_mapping(&mapping);
+        return false;
+    }
+
+    size_t capacity = (size_t)header.capacity;
+    uint8_t* block = (uint8_t*)mapping.data + SNAPSHOT_HEADER_SIZE;
+    table->slots = (HashTableSlots){
+        .capacity = capacity,
+        .keys = (uint64_t*)block,
+        .values = (uint32_t*)(block + capacity * sizeof(uint64_t)),
+        .metadata = block + capacity * (sizeof(uint64_t) + sizeof(uint32_t)),
+    };
+    table->count = (size_t)header.count;
+    table->nodes_visited = (size_t)header.nodes_visited;
+    table->seed = (XXH64_hash_t)header.seed;
+    table->probing = (HashTableProbing)header.probing;
+    table->mapping = mapping;
+    table->read_only = mode == HASH_TABLE_MAP_READ_ONLY;
+    return true;
+}
+
+static size_t group_probe_distance(const HashTableSlots* slots, size_t index, uint64_t hash) {
+    size_t group_mask = slots->capacity / GROUP_WIDTH - 1;
+    size_t group = get_hash_index(slots, hash) / GROUP_WIDTH;
+    size_t target_group = index / GROUP_WIDTH;
+
+    size_t step = 0;
+    while (group != target_group) {
+        group = (group + step + 1) & group_mask;
+        ++step;
+    }
+    return step;
+}
+
+void hash_table_get_stats(const HashTable* table, HashTableStats* stats) {
+    assert(table != NULL && stats != NULL);
+    memset(stats, 0, sizeof(HashTableStats));
+
+    const HashTableSlots* slots = &table->slots;
+    stats->capacity = slots->capacity;
+    stats->count = table->count;
+    stats->load_factor = slots->capacity > 0 ? (double)table->count / (double)slots->capacity : 0.0;
+    stats->nodes_visited = table->nodes_visited;
+    stats->old_capacity = table->old_slots.capacity;
+
+    size_t entries = 0;
+    size_t total_distance = 0;
+    for (size_t i = 0; i < slots->capacity; i++) {
+        if (!is_slot_occupied(table->probing, slots, i)) {
+            if (table->probing == HASH_TABLE_PROBING_GROUP && slots->metadata[i] == CONTROL_DELETED)
+                ++stats->tombstones;
+            continue;
+        }
+
+        size_t distance;
+        if (table->probing == HASH_TABLE_PROBING_GROUP)
+            distance = group_probe_distance(slots, i, hash_key(slots->keys[i], table->seed));
+        else
+            distance = probe_distance_from_metadata(slots->metadata[i]);
+
+        size_t bucket = distance < HASH_TABLE_PROBE_HISTOGRAM_BUCKETS ? distance : HASH_TABLE_PROBE_HISTOGRAM_BUCKETS - 1;
+        ++stats->probe_histogram[bucket];
+        if (distance > stats->max_probe_distance)
+            stats->max_probe_distance = distance;
+        total_distance += distance;
+        ++entries;
+    }
+    stats->mean_probe_distance = entries > 0 ? (double)total_distance / (double)entries : 0.0;
+
+#if defined(HASH_TABLE_ENABLE_STATS)
+    stats->resize_count = table->resize_count;
+    stats->resize_seconds = (double)table->resize_nanoseconds * 1e-9;
+#endif
+}
@@ -0,0 +1,365 @@
+#include "loose_quad_tree.h"
+#include "list_utilities.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_NODE_CAPACITY 64
+// A depth-first walk never holds more than three siblings per level plus
+// the node being expanded.
+#define NODE_STACK_CAPACITY ((LOOSE_QUAD_TREE_MAX_DEPTH + 1) * QUAD_TREE_MAX_CHILDREN)
+
+// Same child order and center-line rule as QuadTree.
+#define CHILD_INDEX_NE 0
+#define CHILD_INDEX_NW 1
+#define CHILD_INDEX_SE 2
+#define CHILD_INDEX_SW 3
+
+static inline bool is_leaf_node(const LooseQuadTreeNode* node) {
+    return node->first_child == QUAD_TREE_NULL_NODE;
+}
+
+static inline Rect loose_bounds(Rect bounds) {
+    bounds.half_width *= 2.0f;
+    bounds.half_height *= 2.0f;
+    return bounds;
+}
+
+// Compares the computed edges rather than sizes, so that anything that
+// rects_intersect finds overlapping a box also overlaps the box it sits in.
+static inline bool is_rect_inside_rect(Rect inner, Rect outer) {
+    return inner.center.x - inner.half_width >= outer.center.x - outer.half_width && inner.center.x + inner.half_width <= outer.center.x + outer.half_width && inner.center.y - inner.half_height >= outer.center.y - outer.half_height && inner.center.y + inner.half_height <= outer.center.y + outer.half_height;
+}
+
+static void initialize_node(LooseQuadTreeNode* node, Rect bounds, uint32_t depth) {
+    memset(node, 0, sizeof(LooseQuadTreeNode));
+    node->bounds = bounds;
+    node->first_child = QUAD_TREE_NULL_NODE;
+    node->depth = depth;
+}
+
+static void append_entry(LooseQuadTreeNode* node, LooseQuadTreeEntry entry) {
+    if (node->entry_count == node->entry_capacity)
+        increase_list_capacity((void**)&node->entries, &node->entry_capacity, sizeof(LooseQuadTreeEntry), node->entry_capacity > 0 ? node->entry_capacity : LOOSE_QUAD_TREE_NODE_CAPACITY);
+    node->entries[node->entry_count++] = entry;
+}
+
+// The child whose region holds the center of bounds, if its loose bounds
+// also hold the whole box.
+static uint32_t child_fitting(const LooseQuadTree* tree, const LooseQuadTreeNode* node, Rect bounds) {
+    uint32_t quadrant = (bounds.center.x < node->bounds.center.x ? CHILD_INDEX_NW : CHILD_INDEX_NE) | (bounds.center.y > node->bounds.center.y ? CHILD_INDEX_SE : CHILD_INDEX_NE);
+    uint32_t child = node->first_child + quadrant;
+    return is_rect_inside_rect(bounds, loose_bounds(tree->nodes[child].bounds)) ? child : QUAD_TREE_NULL_NODE;
+}
+
+static uint32_t allocate_sibling_block(LooseQuadTree* tree) {
+    if (tree->free_block != QUAD_TREE_NULL_NODE) {
+        uint32_t block = tree->free_block;
+        tree->free_block = tree->nodes[block].first_child;
+        return block;
+    }
+
+    if (tree->node_count + QUAD_TREE_MAX_CHILDREN > tree->node_capacity)
+        increase_list_capacity((void**)&tree->nodes, &tree->node_capacity, sizeof(LooseQuadTreeNode), tree->node_capacity);
+    assert(tree->node_count + QUAD_TREE_MAX_CHILDREN < QUAD_TREE_NULL_NODE);
+
+    uint32_t block = (uint32_t)tree->node_count;
+    tree->node_count += QUAD_TREE_MAX_CHILDREN;
+    return block;
+}
+
+// Splits a full leaf and moves down every entry that fits a child.
+static void subdivide_node(LooseQuadTree* tree, uint32_t node_index) {
+    uint32_t block = allocate_sibling_block(tree);
+    LooseQuadTreeNode* node = &tree->nodes[node_index];
+
+    float x = node->bounds.center.x;
+    float y = node->bounds.center.y;
+    float hw = node->bounds.half_width / 2.0f;
+    float hh = node->bounds.half_height / 2.0f;
+    uint32_t depth = node->depth + 1;
+
+    initialize_node(&tree->nodes[block + CHILD_INDEX_NE], create_rect(x + hw, y - hh, hw, hh), depth);
+    initialize_node(&tree->nodes[block + CHILD_INDEX_NW], create_rect(x - hw, y - hh, hw, hh), depth);
+    initialize_node(&tree->nodes[block + CHILD_INDEX_SE], create_rect(x + hw, y + hh, hw, hh), depth);
+    initialize_node(&tree->nodes[block + CHILD_INDEX_SW], create_rect(x - hw, y + hh, hw, hh), depth);
+    node->first_child = block;
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < node->entry_count; i++) {
+        uint32_t child = child_fitting(tree, node, node->entries[i].bounds);
+        if (child == QUAD_TREE_NULL_NODE) {
+            node->entries[kept++] = node->entries[i];
+            continue;
+        }
+        append_entry(&tree->nodes[child], node->entries[i]);
+        ++tree->nodes[child].count;
+    }
+    node->entry_count = kept;
+}
+
+// Pulls every entry below node_index up into it and puts the sibling blocks
+// back on the free list.
+static void collapse_node(LooseQuadTree* tree, uint32_t node_index) {
+    uint32_t stack[NODE_STACK_CAPACITY];
+    size_t stack_count = 0;
+    stack[stack_count++] = tree->nodes[node_index].first_child;
+    tree->nodes[node_index].first_child = QUAD_TREE_NULL_NODE;
+
+    while (stack_count > 0) {
+        uint32_t block = stack[--stack_count];
+        for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+            LooseQuadTreeNode* child = &tree->nodes[block + i];
+            for (uint32_t j = 0; j < child->entry_count; j++) {
+                append_entry(&tree->nodes[node_index], child->entries[j]);
+            }
+            free(child->entries);
+            child->entries = NULL;
+            child->entry_count = 0;
+            child->entry_capacity = 0;
+            if (!is_leaf_node(child))
+                stack[stack_count++] = child->first_child;
+        }
+        tree->nodes[block].first_child = tree->free_block;
+        tree->free_block = block;
+    }
+}
+
+LooseQuadTree* create_new_loose_quad_tree(Rect bounds) {
+    LooseQuadTree* tree = (LooseQuadTree*)malloc(sizeof(LooseQuadTree));
+    assert(tree != NULL);
+    memset(tree, 0, sizeof(LooseQuadTree));
+    increase_list_capacity((void**)&tree->nodes, &tree->node_capacity, sizeof(LooseQuadTreeNode), INITIAL_NODE_CAPACITY);
+
+    initialize_node(&tree->nodes[0], bounds, 0);
+    tree->node_count = 1;
+    tree->free_block = QUAD_TREE_NULL_NODE;
+    return tree;
+}
+
+void free_loose_quad_tree(LooseQuadTree* tree) {
+    if (tree == NULL)
+        return;
+
+    for (size_t i = 0; i < tree->node_count; i++) {
+        free(tree->nodes[i].entries);
+    }
+    free(tree->nodes);
+    free(tree);
+}
+
+bool loose_quad_tree_insert(LooseQuadTree* tree, Rect bounds, uint64_t id) {
+    assert(tree != NULL);
+    if (!is_point_inside_rect(tree->nodes[0].bounds, bounds.center))
+        return false;
+
+    LooseQuadTreeEntry entry = {.bounds = bounds, .id = id};
+    uint32_t node_index = 0;
+    for (;;) {
+        LooseQuadTreeNode* node = &tree->nodes[node_index];
+        if (is_leaf_node(node) && node->entry_count >= LOOSE_QUAD_TREE_NODE_CAPACITY && node->depth < LOOSE_QUAD_TREE_MAX_DEPTH) {
+            subdivide_node(tree, node_index);
+            node = &tree->nodes[node_index];
+        }
+
+        ++node->count;
+        uint32_t child = is_leaf_node(node) ? QUAD_TREE_NULL_NODE : child_fitting(tree, node, bounds);
+        if (child == QUAD_TREE_NULL_NODE) {
+            append_entry(node, entry);
+            return true;
+        }
+        node_index = child;
+    }
+}
+
+bool loose_quad_tree_remove(LooseQuadTree* tree, Rect bounds, uint64_t id) {
+    assert(tree != NULL);
+    if (!is_point_inside_rect(tree->nodes[0].bounds, bounds.center))
+        return false;
+
+    // Entries only move down when their node splits, so they are always
+    // found by the same walk that would insert them now.
+    uint32_t path[LOOSE_QUAD_TREE_MAX_DEPTH + 1];
+    size_t path_length = 0;
+    uint32_t node_index = 0;
+    for (;;) {
+        path[path_length++] = node_index;
+        const LooseQuadTreeNode* node = &tree->nodes[node_index];
+        uint32_t child = is_leaf_node(node) ? QUAD_TREE_NULL_NODE : child_fitting(tree, node, bounds);
+        if (child == QUAD_TREE_NULL_NODE)
+            break;
+        node_index = child;
+    }
+
+    LooseQuadTreeNode* node = &tree->nodes[node_index];
+    uint32_t entry_index = 0;
+    while (entry_index < node->entry_count && node->entries[entry_index].id != id) {
+        ++entry_index;
+    }
+    if (entry_index == node->entry_count)
+        return false;
+    node->entries[entry_index] = node->entries[--node->entry_count];
+
+    for (size_t i = 0; i < path_length; i++) {
+        --tree->nodes[path[i]].count;
+    }
+    // The highest node that fits in one leaf again absorbs its subtree.
+    for (size_t i = 0; i < path_length; i++) {
+        LooseQuadTreeNode* ancestor = &tree->nodes[path[i]];
+        if (!is_leaf_node(ancestor) && ancestor->count <= LOOSE_QUAD_TREE_NODE_CAPACITY) {
+            collapse_node(tree, path[i]);
+            break;
+        }
+    }
+    return true;
+}
+
+void loose_quad_tree_search(const LooseQuadTree* tree, Rect range, uint64_t* found, int* found_count, int max_count) {
+    assert(tree != NULL);
+
+    uint32_t stack[NODE_STACK_CAPACITY];
+    size_t stack_count = 0;
+    stack[stack_count++] = 0;
+
+    while (stack_count > 0 && *found_count < max_count) {
+        uint32_t node_index = stack[--stack_count];
+        const LooseQuadTreeNode* node = &tree->nodes[node_index];
+        // Boxes too large for any child stay in the root even when they
+        // reach past its loose bounds, so the root is always searched.
+        if (node->count == 0 || (node_index != 0 && !rects_intersect(loose_bounds(node->bounds), range)))
+            continue;
+
+        for (uint32_t i = 0; i < node->entry_count && *found_count < max_count; i++) {
+            if (rects_intersect(node->entries[i].bounds, range))
+                found[(*found_count)++] = node->entries[i].id;
+        }
+        if (is_leaf_node(node))
+            continue;
+        for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+            stack[stack_count++] = node->first_child + QUAD_TREE_MAX_CHILDREN - 1 - i;
+        }
+    }
+}
+
+// Work items for the pair search. Pairs within a subtree, pairs between
+// two disjoint subtrees, and pairs between one node's own entries and a
+// subtree below or beside it.
+typedef enum PairTaskKind {
+    PAIR_TASK_WITHIN,
+    PAIR_TASK_BETWEEN,
+    PAIR_TASK_ENTRIES,
+} PairTaskKind;
+
+typedef struct PairTask {
+    PairTaskKind kind;
+    uint32_t a;
+    uint32_t b;
+} PairTask;
+
+typedef struct PairTaskStack {
+    PairTask* items;
+    size_t count;
+    size_t capacity;
+} PairTaskStack;
+
+static void push_pair_task(PairTaskStack* stack, PairTaskKind kind, uint32_t a, uint32_t b) {
+    if (stack->count == stack->capacity)
+        increase_list_capacity((void**)&stack->items, &stack->capacity, sizeof(PairTask), stack->capacity > 0 ? stack->capacity : NODE_STACK_CAPACITY);
+    stack->items[stack->count++] = (PairTask){.kind = kind, .a = a, .b = b};
+}
+
+// Every entry below a node lies inside its loose bounds, apart from the
+// oversized boxes kept in the root.
+static bool subtrees_may_overlap(const LooseQuadTree* tree, uint32_t a, uint32_t b) {
+    if (a == 0 || b == 0)
+        return true;
+    return rects_intersect(loose_bounds(tree->nodes[a].bounds), loose_bounds(tree->nodes[b].bounds));
+}
+
+static bool visit_entry_pairs(const LooseQuadTreeNode* a, const LooseQuadTreeNode* b, LooseQuadTreePairVisitor visitor, void* context) {
+    for (uint32_t i = 0; i < a->entry_count; i++) {
+        for (uint32_t j = 0; j < b->entry_count; j++) {
+            if (rects_intersect(a->entries[i].bounds, b->entries[j].bounds) && !visitor(&a->entries[i], &b->entries[j], context))
+                return false;
+        }
+    }
+    return true;
+}
+
+// A self-join of the tree: each subtree is paired with itself and with the
+// subtrees it may overlap, and pairs of nodes whose loose bounds are apart
+// are dropped together with everything below them.
+bool quad_tree_find_all_overlapping_pairs(const LooseQuadTree* tree, LooseQuadTreePairVisitor visitor, void* context) {
+    assert(tree != NULL && visitor != NULL);
+
+    PairTaskStack stack = {0};
+    push_pair_task(&stack, PAIR_TASK_WITHIN, 0, 0);
+
+    bool completed = true;
+    while (stack.count > 0 && completed) {
+        PairTask task = stack.items[--stack.count];
+        const LooseQuadTreeNode* a = &tree->nodes[task.a];
+        const LooseQuadTreeNode* b = &tree->nodes[task.b];
+
+        if (task.kind == PAIR_TASK_WITHIN) {
+            if (a->count < 2)
+                continue;
+            for (uint32_t i = 0; i < a->entry_count && completed; i++) {
+                for (uint32_t j = i + 1; j < a->entry_count && completed; j++) {
+                    if (rects_intersect(a->entries[i].bounds, a->entries[j].bounds))
+                        completed = visitor(&a->entries[i], &a->entries[j], context);
+                }
+            }
+            if (is_leaf_node(a))
+                continue;
+            for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+                uint32_t child = a->first_child + i;
+                if (a->entry_count > 0)
+                    push_pair_task(&stack, PAIR_TASK_ENTRIES, task.a, child);
+                push_pair_task(&stack, PAIR_TASK_WITHIN, child, child);
+                for (uint32_t j = i + 1; j < QUAD_TREE_MAX_CHILDREN; j++) {
+                    push_pair_task(&stack, PAIR_TASK_BETWEEN, child, a->first_child + j);
+                }
+            }
+            continue;
+        }
+
+        if (a->count == 0 || b->count == 0 || !subtrees_may_overlap(tree, task.a, task.b))
+            continue;
+
+        // Only a's own entries take part in an entries task, against all of b.
+        if (task.kind == PAIR_TASK_ENTRIES) {
+            completed = visit_entry_pairs(a, b, visitor, context);
+            if (!is_leaf_node(b)) {
+                for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+                    push_pair_task(&stack, PAIR_TASK_ENTRIES, task.a, b->first_child + i);
+                }
+            }
+            continue;
+        }
+
+        completed = visit_entry_pairs(a, b, visitor, context);
+        if (!is_leaf_node(b) && a->entry_count > 0) {
+            for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+                push_pair_task(&stack, PAIR_TASK_ENTRIES, task.a, b->first_child + i);
+            }
+        }
+        if (!is_leaf_node(a) && b->entry_count > 0) {
+            for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+                push_pair_task(&stack, PAIR_TASK_ENTRIES, task.b, a->first_child + i);
+            }
+        }
+        if (!is_leaf_node(a) && !is_leaf_node(b)) {
+            for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+                for (uint32_t j = 0; j < QUAD_TREE_MAX_CHILDREN; j++) {
+                    push_pair_task(&stack, PAIR_TASK_BETWEEN, a->first_child + i, b->first_child + j);
+                }
+            }
+        }
+    }
+    free(stack.items);
+    return completed;
+}
@@ -1,102 +1,648 @@
 #include "quad_tree.h"
+#include "file_mapping.h"
+#include "list_utilities.h"
+
 #include <assert.h>
-#include <corecrt_search.h>
 #include <math.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define QUAD_TREE_USE_AVX2
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QUAD_TREE_USE_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Points tested per step by the leaf kernels.
+#if defined(QUAD_TREE_USE_AVX2)
+#define LEAF_LANES 8
+#else
+#define LEAF_LANES 4
+#endif
 
 #define QUAD_TREE_INDEX_NE 0
 #define QUAD_TREE_INDEX_NW 1
 #define QUAD_TREE_INDEX_SE 2
 #define QUAD_TREE_INDEX_SW 3
 
-static void subdivide_quad_tree(QuadTree* tree) {
-    assert(tree->is_leaf);
+// The root and its first sibling block; the pool doubles as the tree grows.
+#define INITIAL_NODE_CAPACITY      (1 + QUAD_TREE_MAX_CHILDREN)
+#define NODE_STACK_INLINE_CAPACITY 64
+#define MORTON_LEVELS              16
+#define MORTON_BATCH_SIZE          64
+#define RADIX_BITS                 11
+#define VISIT_CHUNK_SIZE           64
+#define BATCH_CHUNK_SIZE           16
+#define BATCH_QUERIES_PER_THREAD   64
+#define BATCH_BUFFER_CAPACITY      1024
+#define JOIN_TASKS_PER_THREAD      16
 
-    float x = tree->bounds.center.x;
-    float y = tree->bounds.center.y;
-    float hw = tree->bounds.half_width / 2.0f;
-    float hh = tree->bounds.half_height / 2.0f;
+#define SNAPSHOT_MAGIC       "QTSNAP\0"
+#define SNAPSHOT_VERSION     1
+#define SNAPSHOT_BYTE_ORDER  0x01020304u
+#define SNAPSHOT_HEADER_SIZE 64
 
-    QuadTree* northeast = create_new_tree(create_rect(x + hw, y - hh, hw, hh));
-    QuadTree* northwest = create_new_tree(create_rect(x - hw, y - hh, hw, hh));
-    QuadTree* southeast = create_new_tree(create_rect(x + hw, y + hh, hw, hh));
-    QuadTree* southwest = create_new_tree(create_rect(x - hw, y + hh, hw, hh));
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t node_size;
+    uint32_t leaf_capacity;
+    uint64_t node_count;
+    uint64_t point_count;
+} SnapshotHeader;
 
-    for (int i = 0; i < tree->count; i++) {
-        Point point = tree->points[i];
-        if (insert_point_into_quadtree(northeast, point))
-            continue;
-        if (insert_point_into_quadtree(northwest, point))
-            continue;
-        if (insert_point_into_quadtree(southeast, point))
-            continue;
-        if (insert_point_into_quadtree(southwest, point))
-            continue;
+// Set on cursor stack entries for nodes known to lie inside the query.
+#define CURSOR_INSIDE_FLAG 0x80000000u
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+// Logging compiles out of release builds unless explicitly requested.
+#if !defined(NDEBUG) || defined(QUAD_TREE_ENABLE_LOGGING)
+#define QUAD_TREE_LOG(...) quad_tree_log(__VA_ARGS__)
+#else
+#define QUAD_TREE_LOG(...) ((void)0)
+#endif
+
+#if defined(QUAD_TREE_ENABLE_STATS)
+#define STATS_COUNT_NODES(count)  (query_metrics.nodes_visited += (count))
+#define STATS_COUNT_POINTS(count) (query_metrics.points_visited += (count))
+#else
+#define STATS_COUNT_NODES(count)  ((void)0)
+#define STATS_COUNT_POINTS(count) ((void)0)
+#endif
+
+static QuadTreeLogHook log_hook = NULL;
+static void* log_hook_context = NULL;
+
+#if !defined(NDEBUG) || defined(QUAD_TREE_ENABLE_LOGGING)
+static void quad_tree_log(const char* format, ...) {
+    if (log_hook == NULL)
+        return;
+
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    log_hook(message, log_hook_context);
+}
+#endif
+
+#if defined(QUAD_TREE_ENABLE_STATS)
+static THREAD_LOCAL QuadTreeQueryMetrics query_metrics;
+#endif
+
+// Explicit traversal stack. Shallow walks stay on the C stack; deep ones
+// (clustered data) spill to the heap instead of recursing.
+typedef struct NodeStack {
+    uint32_t* items;
+    size_t count;
+    size_t capacity;
+    uint32_t inline_items[NODE_STACK_INLINE_CAPACITY];
+} NodeStack;
+
+static void initialize_node_stack(NodeStack* stack) {
+    stack->items = stack->inline_items;
+    stack->count = 0;
+    stack->capacity = NODE_STACK_INLINE_CAPACITY;
+}
+
+static void destroy_node_stack(NodeStack* stack) {
+    if (stack->items != stack->inline_items)
+        free(stack->items);
+}
+
+static void push_node(NodeStack* stack, uint32_t node_index) {
+    if (stack->count == stack->capacity) {
+        uint32_t* items = (uint32_t*)malloc(stack->capacity * 2 * sizeof(uint32_t));
+        assert(items != NULL);
+        memcpy(items, stack->items, stack->count * sizeof(uint32_t));
+        destroy_node_stack(stack);
+        stack->items = items;
+        stack->capacity *= 2;
     }
+    stack->items[stack->count++] = node_index;
+}
 
-    tree->children[QUAD_TREE_INDEX_NE] = northeast;
-    tree->children[QUAD_TREE_INDEX_NW] = northwest;
-    tree->children[QUAD_TREE_INDEX_SE] = southeast;
-    tree->children[QUAD_TREE_INDEX_SW] = southwest;
-    tree->is_leaf = false;
+static uint32_t pop_node(NodeStack* stack) {
+    assert(stack->count > 0);
+    return stack->items[--stack->count];
 }
 
-static uint32_t count_points_in_tree(const QuadTree* tree) {
-    assert(tree != NULL);
+// Pushes the children in reverse so that they are visited NE, NW, SE, SW.
+static void push_children(NodeStack* stack, uint32_t first_child) {
+    for (uint32_t i = QUAD_TREE_MAX_CHILDREN; i > 0; i--) {
+        push_node(stack, first_child + i - 1);
+    }
+}
+
+// Binary min-heap used by the nearest neighbour search, both for the nodes
+// still to visit and, with negated keys, for the k best points so far.
+typedef struct HeapEntry {
+    float key;
+    uint32_t node_index;
+    Point point;
+} HeapEntry;
+
+typedef struct MinHeap {
+    HeapEntry* items;
+    size_t count;
+    size_t capacity;
+} MinHeap;
+
+static void heap_push(MinHeap* heap, HeapEntry entry) {
+    if (heap->count == heap->capacity)
+        increase_list_capacity((void**)&heap->items, &heap->capacity, sizeof(HeapEntry), heap->capacity > 0 ? heap->capacity : 16);
 
-    if (tree->is_leaf)
-        return tree->count;
-    uint32_t total = 0;
-    for (int i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
-        total += count_points_in_tree(tree->children[i]);
+    size_t index = heap->count++;
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (heap->items[parent].key <= entry.key)
+            break;
+        heap->items[index] = heap->items[parent];
+        index = parent;
     }
-    return total;
+    heap->items[index] = entry;
 }
 
-static void collect_points_in_quad_tree(const QuadTree* tree, Point* buffer, uint32_t buffer_size, uint32_t* count) {
-    if (*count >= buffer_size)
+static HeapEntry heap_pop(MinHeap* heap) {
+    assert(heap->count > 0);
+    HeapEntry top = heap->items[0];
+    HeapEntry last = heap->items[--heap->count];
+
+    size_t index = 0;
+    for (;;) {
+        size_t child = index * 2 + 1;
+        if (child >= heap->count)
+            break;
+        if (child + 1 < heap->count && heap->items[child + 1].key < heap->items[child].key)
+            ++child;
+        if (last.key <= heap->items[child].key)
+            break;
+        heap->items[index] = heap->items[child];
+        index = child;
+    }
+    if (heap->count > 0)
+        heap->items[index] = last;
+    return top;
+}
+
+static inline bool is_leaf_node(const QuadTreeNode* node) {
+    return node->first_child == QUAD_TREE_NULL_NODE;
+}
+
+// id_slots is created by the first insert with an id, so trees that never
+// use ids do not pay for the index.
+static inline bool has_id_slots(const QuadTree* tree) {
+    return tree->id_slots.slots.keys != NULL;
+}
+
+// Points on the center lines go east and north, matching the order the
+// children used to be tried in.
+static inline uint32_t child_quadrant(const QuadTreeNode* node, Point point) {
+    return (point.x < node->bounds.center.x ? QUAD_TREE_INDEX_NW : QUAD_TREE_INDEX_NE) | (point.y > node->bounds.center.y ? QUAD_TREE_INDEX_SE : QUAD_TREE_INDEX_NE);
+}
+
+static inline uint32_t child_containing(const QuadTreeNode* node, Point point) {
+    return node->first_child + child_quadrant(node, point);
+}
+
+static void initialize_node(QuadTreeNode* node, Rect bounds) {
+    memset(node, 0, sizeof(QuadTreeNode));
+    node->bounds = bounds;
+    node->first_child = QUAD_TREE_NULL_NODE;
+    node->bucket = QUAD_TREE_NULL_NODE;
+    node->parent = QUAD_TREE_NULL_NODE;
+}
+
+// Returns the index of four consecutive nodes, reusing a released block if
+// there is one. Growing the pool moves it, so node pointers taken before
+// this call must be fetched again.
+static uint32_t allocate_sibling_block(QuadTree* tree) {
+    if (tree->free_block != QUAD_TREE_NULL_NODE) {
+        uint32_t block = tree->free_block;
+        tree->free_block = tree->nodes[block].first_child;
+        return block;
+    }
+
+    if (tree->node_count + QUAD_TREE_MAX_CHILDREN > tree->node_capacity)
+        increase_list_capacity((void**)&tree->nodes, &tree->node_capacity, sizeof(QuadTreeNode), tree->node_capacity);
+    assert(tree->node_count + QUAD_TREE_MAX_CHILDREN < QUAD_TREE_NULL_NODE);
+
+    uint32_t block = (uint32_t)tree->node_count;
+    tree->node_count += QUAD_TREE_MAX_CHILDREN;
+    return block;
+}
+
+static inline float* leaf_xs(const QuadTree* tree, const QuadTreeNode* node) {
+    return tree->xs + (size_t)node->bucket * tree->bucket_size;
+}
+
+static inline float* leaf_ys(const QuadTree* tree, const QuadTreeNode* node) {
+    return tree->ys + (size_t)node->bucket * tree->bucket_size;
+}
+
+static inline uint64_t* leaf_ids(const QuadTree* tree, const QuadTreeNode* node) {
+    return tree->ids + (size_t)node->bucket * tree->bucket_size;
+}
+
+static inline uint32_t leaf_slot(const QuadTree* tree, const QuadTreeNode* node, uint32_t index) {
+    return node->bucket * tree->bucket_size + index;
+}
+
+static inline Point leaf_point(const QuadTree* tree, const QuadTreeNode* node, uint32_t index) {
+    Point point = {
+        .x = leaf_xs(tree, node)[index],
+        .y = leaf_ys(tree, node)[index],
+    };
+    return point;
+}
+
+// Makes sure the next count bucket allocations do not move the bucket
+// arrays.
+static void reserve_buckets(QuadTree* tree, size_t count) {
+    size_t free_count = tree->bucket_capacity - tree->bucket_count;
+    if (free_count >= count)
         return;
-    if (tree->is_leaf) {
-        for (int i = 0; i < tree->count; i++) {
-            buffer[*count] = tree->points[i];
-            ++(*count);
-            if (*count >= buffer_size)
-                break;
+
+    size_t increase = tree->bucket_capacity > count ? tree->bucket_capacity : count;
+    size_t x_capacity = tree->bucket_capacity * tree->leaf_capacity;
+    size_t y_capacity = x_capacity;
+    size_t id_capacity = x_capacity;
+    increase_list_capacity((void**)&tree->xs, &x_capacity, sizeof(float), increase * tree->leaf_capacity);
+    increase_list_capacity((void**)&tree->ys, &y_capacity, sizeof(float), increase * tree->leaf_capacity);
+    increase_list_capacity((void**)&tree->ids, &id_capacity, sizeof(uint64_t), increase * tree->leaf_capacity);
+    increase_list_capacity((void**)&tree->bucket_nodes, &tree->bucket_capacity, sizeof(uint32_t), increase);
+    // Slots are stored as uint32_t in id_slots.
+    assert(tree->bucket_capacity * tree->leaf_capacity < UINT32_MAX);
+}
+
+// Buckets held by a leaf with count points: one, or for overflow leaves the
+// smallest power of two that fits them.
+static inline uint32_t leaf_bucket_run(const QuadTree* tree, uint32_t count) {
+    uint32_t buckets = (count + tree->leaf_capacity - 1) / tree->leaf_capacity;
+    uint32_t run = 1;
+    while (run < buckets) {
+        run *= 2;
+    }
+    return run;
+}
+
+static inline bool is_leaf_full(const QuadTree* tree, const QuadTreeNode* node) {
+    return is_leaf_node(node) && node->count > 0 && node->count == tree->leaf_capacity * leaf_bucket_run(tree, node->count);
+}
+
+static inline uint32_t run_class(uint32_t run) {
+    uint32_t size_class = 0;
+    while ((1u << size_class) < run) {
+        ++size_class;
+    }
+    return size_class;
+}
+
+// A free run is marked by a null owner in bucket_nodes. Its first x and y
+// slots link it to the next and previous free runs of its length, and its
+// first id slot holds that length's class.
+static inline uint32_t next_free_run(const QuadTree* tree, uint32_t bucket) {
+    uint32_t next;
+    memcpy(&next, &tree->xs[(size_t)bucket * tree->leaf_capacity], sizeof(uint32_t));
+    return next;
+}
+
+static inline uint32_t previous_free_run(const QuadTree* tree, uint32_t bucket) {
+    uint32_t previous;
+    memcpy(&previous, &tree->ys[(size_t)bucket * tree->leaf_capacity], sizeof(uint32_t));
+    return previous;
+}
+
+static inline void link_free_runs(QuadTree* tree, uint32_t previous, uint32_t next) {
+    if (previous != QUAD_TREE_NULL_NODE)
+        memcpy(&tree->xs[(size_t)previous * tree->leaf_capacity], &next, sizeof(uint32_t));
+    if (next != QUAD_TREE_NULL_NODE)
+        memcpy(&tree->ys[(size_t)next * tree->leaf_capacity], &previous, sizeof(uint32_t));
+}
+
+static inline bool is_free_run(const QuadTree* tree, uint32_t bucket, uint32_t size_class) {
+    return bucket < tree->bucket_count && tree->bucket_nodes[bucket] == QUAD_TREE_NULL_NODE && tree->ids[(size_t)bucket * tree->leaf_capacity] == size_class;
+}
+
+static void push_free_run(QuadTree* tree, uint32_t bucket, uint32_t size_class) {
+    uint32_t head = tree->free_runs[size_class];
+    link_free_runs(tree, QUAD_TREE_NULL_NODE, bucket);
+    link_free_runs(tree, bucket, head);
+    tree->ids[(size_t)bucket * tree->leaf_capacity] = size_class;
+    tree->bucket_nodes[bucket] = QUAD_TREE_NULL_NODE;
+    tree->free_runs[size_class] = bucket;
+}
+
+static void unlink_free_run(QuadTree* tree, uint32_t bucket) {
+    uint32_t size_class = (uint32_t)tree->ids[(size_t)bucket * tree->leaf_capacity];
+    uint32_t previous = previous_free_run(tree, bucket);
+    uint32_t next = next_free_run(tree, bucket);
+    if (previous == QUAD_TREE_NULL_NODE)
+        tree->free_runs[size_class] = next;
+    link_free_runs(tree, previous, next);
+}
+
+static void reset_free_runs(QuadTree* tree) {
+    for (uint32_t i = 0; i < QUAD_TREE_BUCKET_RUN_CLASSES; i++) {
+        tree->free_runs[i] = QUAD_TREE_NULL_NODE;
+    }
+}
+
+// Runs start at a multiple of their length, so a released run can merge
+// with its buddy, the other half of the run twice as long, for as long as
+// that half is free too.
+static void release_buckets(QuadTree* tree, uint32_t first, uint32_t run) {
+    uint32_t size_class = run_class(run);
+    while (size_class + 1 < QUAD_TREE_BUCKET_RUN_CLASSES) {
+        uint32_t buddy = first ^ (1u << size_class);
+        if (!is_free_run(tree, buddy, size_class))
+            break;
+        unlink_free_run(tree, buddy);
+        if (buddy < first)
+            first = buddy;
+        ++size_class;
+    }
+    push_free_run(tree, first, size_class);
+}
+
+// Takes a free run of the given power-of-two length for owner, splitting
+// the shortest longer one if none is free. Otherwise appends one at the
+// next multiple of its length and frees the buckets skipped to get there.
+static uint32_t allocate_buckets(QuadTree* tree, uint32_t run, uint32_t owner) {
+    uint32_t size_class = run_class(run);
+    uint32_t found_class = size_class;
+    while (found_class < QUAD_TREE_BUCKET_RUN_CLASSES && tree->free_runs[found_class] == QUAD_TREE_NULL_NODE) {
+        ++found_class;
+    }
+
+    uint32_t first;
+    if (found_class < QUAD_TREE_BUCKET_RUN_CLASSES) {
+        first = tree->free_runs[found_class];
+        unlink_free_run(tree, first);
+        while (found_class > size_class) {
+            --found_class;
+            push_free_run(tree, first + (1u << found_class), found_class);
+        }
+    } else {
+        size_t start = (tree->bucket_count + run - 1) / run * run;
+        reserve_buckets(tree, start + run - tree->bucket_count);
+        uint32_t gap = (uint32_t)tree->bucket_count;
+        tree->bucket_count = start;
+        while (gap < start) {
+            uint32_t piece = gap & (~gap + 1);
+            release_buckets(tree, gap, piece);
+            gap += piece;
         }
+        first = (uint32_t)start;
+        tree->bucket_count += run;
+    }
+
+    for (uint32_t i = 0; i < run; i++) {
+        tree->bucket_nodes[first + i] = owner;
     }
-    else {
-        for (int i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
-            collect_points_in_quad_tree(tree->children[i], buffer, buffer_size, count);
+    return first;
+}
+
+static void release_bucket(QuadTree* tree, QuadTreeNode* node) {
+    if (node->bucket == QUAD_TREE_NULL_NODE)
+        return;
+
+    release_buckets(tree, node->bucket, leaf_bucket_run(tree, node->count));
+    node->bucket = QUAD_TREE_NULL_NODE;
+}
+
+// Doubles the run of a full leaf that cannot split. The run grows in place
+// when it is the first half of its buddy pair and the second half is free
+// or lies past the end of the arrays, so a leaf churning across a run
+// boundary keeps its buckets. Otherwise the points move to a new run.
+static void grow_leaf(QuadTree* tree, uint32_t node_index) {
+    QuadTreeNode* node = &tree->nodes[node_index];
+    uint32_t run = leaf_bucket_run(tree, node->count);
+    uint32_t next = node->bucket + run;
+    if (node->bucket % (2 * run) == 0 && (next == tree->bucket_count || is_free_run(tree, next, run_class(run)))) {
+        if (next == tree->bucket_count) {
+            reserve_buckets(tree, run);
+            tree->bucket_count += run;
+        } else {
+            unlink_free_run(tree, next);
         }
+        for (uint32_t i = 0; i < run; i++) {
+            tree->bucket_nodes[next + i] = node_index;
+        }
+        QUAD_TREE_LOG("Leaf %u cannot split, growing it in place to %u buckets", node_index, 2 * run);
+        return;
     }
+
+    uint32_t bucket = allocate_buckets(tree, 2 * run, node_index);
+
+    size_t first_slot = (size_t)bucket * tree->leaf_capacity;
+    memcpy(tree->xs + first_slot, leaf_xs(tree, node), node->count * sizeof(float));
+    memcpy(tree->ys + first_slot, leaf_ys(tree, node), node->count * sizeof(float));
+    memcpy(tree->ids + first_slot, leaf_ids(tree, node), node->count * sizeof(uint64_t));
+    release_buckets(tree, node->bucket, run);
+    node->bucket = bucket;
+    for (uint32_t i = 0; i < node->count; i++) {
+        uint64_t id = tree->ids[first_slot + i];
+        if (id != QUAD_TREE_NO_ID)
+            hash_table_insert(&tree->id_slots, id, leaf_slot(tree, node, i));
+    }
+    QUAD_TREE_LOG("Leaf %u cannot split, growing it to %u buckets", node_index, 2 * run);
+}
+
+// Appends to a leaf, growing it if it is full. Callers that hold pointers
+// into the bucket arrays must have reserved a bucket first and must only
+// append to leaves with room.
+static void append_point_to_leaf(QuadTree* tree, uint32_t node_index, Point point, uint64_t id) {
+    QuadTreeNode* node = &tree->nodes[node_index];
+    assert(is_leaf_node(node));
+    if (is_leaf_full(tree, node))
+        grow_leaf(tree, node_index);
+    if (node->bucket == QUAD_TREE_NULL_NODE)
+        node->bucket = allocate_buckets(tree, 1, node_index);
+
+    leaf_xs(tree, node)[node->count] = point.x;
+    leaf_ys(tree, node)[node->count] = point.y;
+    leaf_ids(tree, node)[node->count] = id;
+    if (id != QUAD_TREE_NO_ID)
+        hash_table_insert(&tree->id_slots, id, leaf_slot(tree, node, node->count));
+    ++node->count;
 }
 
-static void try_balance_quad_tree(QuadTree* tree) {
-    if (tree == NULL || tree->is_leaf)
+// Fills the hole left at index with the leaf's last point, since order
+// within a leaf does not matter. The caller drops the removed point's id.
+// Overflow leaves give back the second half of their run once the points
+// fit in the first.
+static void remove_point_from_leaf(QuadTree* tree, QuadTreeNode* node, uint32_t index) {
+    assert(index < node->count);
+    uint32_t run = leaf_bucket_run(tree, node->count);
+    --node->count;
+    if (index != node->count) {
+        uint64_t moved_id = leaf_ids(tree, node)[node->count];
+        leaf_xs(tree, node)[index] = leaf_xs(tree, node)[node->count];
+        leaf_ys(tree, node)[index] = leaf_ys(tree, node)[node->count];
+        leaf_ids(tree, node)[index] = moved_id;
+        if (moved_id != QUAD_TREE_NO_ID)
+            hash_table_insert(&tree->id_slots, moved_id, leaf_slot(tree, node, index));
+    }
+    if (node->count == 0) {
+        release_bucket(tree, node);
         return;
+    }
+    for (uint32_t kept_run = leaf_bucket_run(tree, node->count); kept_run < run; kept_run *= 2) {
+        release_buckets(tree, node->bucket + kept_run, kept_run);
+    }
+}
 
-    uint32_t total_points = count_points_in_tree(tree);
-    assert(total_points == tree->count);
-    if (tree->count <= QUAD_TREE_MAX_POINTS) {
-        fprintf(stderr, "Rebalancing Tree\n");
-        Point buffer[QUAD_TREE_MAX_POINTS];
-        uint32_t count = 0;
-        collect_points_in_quad_tree(tree, buffer, QUAD_TREE_MAX_POINTS, &count);
-        assert(count == tree->count);
-        for (int i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
-            free_quad_tree(tree->children[i]);
+// Puts every sibling block below node_index, and the buckets of the leaves
+// in them, back on the free lists and turns the node into an empty leaf.
+// The stack holds blocks rather than nodes, because linking a block into
+// the free list overwrites its first node.
+static void release_children(QuadTree* tree, uint32_t node_index) {
+    NodeStack stack;
+    initialize_node_stack(&stack);
+    if (!is_leaf_node(&tree->nodes[node_index]))
+        push_node(&stack, tree->nodes[node_index].first_child);
+    tree->nodes[node_index].first_child = QUAD_TREE_NULL_NODE;
+
+    while (stack.count > 0) {
+        uint32_t block = pop_node(&stack);
+        for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+            QuadTreeNode* child = &tree->nodes[block + i];
+            if (is_leaf_node(child))
+                release_bucket(tree, child);
+            else
+                push_node(&stack, child->first_child);
         }
-        memset(&tree->points, 0, sizeof(tree->points));
-        tree->is_leaf = true;
-        tree->count = count;
-        for (int i = 0; i < count; i++) {
-            tree->points[i] = buffer[i];
+        tree->nodes[block].first_child = tree->free_block;
+        tree->free_block = block;
+    }
+    destroy_node_stack(&stack);
+}
+
+// Allocates the four children of a leaf and sets up their bounds. The
+// caller is responsible for moving points into them.
+static uint32_t create_children(QuadTree* tree, uint32_t node_index) {
+    assert(is_leaf_node(&tree->nodes[node_index]));
+
+    uint32_t block = allocate_sibling_block(tree);
+    QuadTreeNode* node = &tree->nodes[node_index];
+
+    float x = node->bounds.center.x;
+    float y = node->bounds.center.y;
+    float hw = node->bounds.half_width / 2.0f;
+    float hh = node->bounds.half_height / 2.0f;
+
+    initialize_node(&tree->nodes[block + QUAD_TREE_INDEX_NE], create_rect(x + hw, y - hh, hw, hh));
+    initialize_node(&tree->nodes[block + QUAD_TREE_INDEX_NW], create_rect(x - hw, y - hh, hw, hh));
+    initialize_node(&tree->nodes[block + QUAD_TREE_INDEX_SE], create_rect(x + hw, y + hh, hw, hh));
+    initialize_node(&tree->nodes[block + QUAD_TREE_INDEX_SW], create_rect(x - hw, y + hh, hw, hh));
+    for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+        tree->nodes[block + i].parent = node_index;
+    }
+
+    node->first_child = block;
+    return block;
+}
+
+// A node splits only above max_depth and while halving its bounds still
+// gives four distinct children. Without the second check, points closer
+// together than float precision would split forever.
+static bool can_subdivide(const QuadTree* tree, const QuadTreeNode* node, uint32_t depth) {
+    float x = node->bounds.center.x;
+    float y = node->bounds.center.y;
+    float hw = node->bounds.half_width / 2.0f;
+    float hh = node->bounds.half_height / 2.0f;
+    return depth < tree->max_depth && x - hw < x && x < x + hw && y - hh < y && y < y + hh;
+}
+
+static uint32_t node_depth(const QuadTree* tree, uint32_t node_index) {
+    uint32_t depth = 0;
+    for (uint32_t index = tree->nodes[node_index].parent; index != QUAD_TREE_NULL_NODE; index = tree->nodes[index].parent) {
+        ++depth;
+    }
+    return depth;
+}
+
+static void subdivide_quad_tree(QuadTree* tree, uint32_t node_index) {
+    create_children(tree, node_index);
+    reserve_buckets(tree, QUAD_TREE_MAX_CHILDREN);
+
+    QuadTreeNode* node = &tree->nodes[node_index];
+    for (uint32_t i = 0; i < node->count; i++) {
+        Point point = leaf_point(tree, node, i);
+        append_point_to_leaf(tree, child_containing(node, point), point, leaf_ids(tree, node)[i]);
+    }
+    release_bucket(tree, node);
+}
+
+// Turns an internal node whose points fit in one leaf back into a leaf.
+static void collapse_quad_tree_node(QuadTree* tree, uint32_t node_index) {
+    assert(!is_leaf_node(&tree->nodes[node_index]) && tree->nodes[node_index].count <= tree->leaf_capacity);
+
+    reserve_buckets(tree, 1);
+    uint32_t bucket = allocate_buckets(tree, 1, node_index);
+    float* xs = tree->xs + (size_t)bucket * tree->leaf_capacity;
+    float* ys = tree->ys + (size_t)bucket * tree->leaf_capacity;
+    uint64_t* ids = tree->ids + (size_t)bucket * tree->leaf_capacity;
+
+    NodeStack stack;
+    initialize_node_stack(&stack);
+    push_node(&stack, tree->nodes[node_index].first_child);
+
+    uint32_t count = 0;
+    while (stack.count > 0) {
+        uint32_t block = pop_node(&stack);
+        for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+            const QuadTreeNode* child = &tree->nodes[block + i];
+            if (!is_leaf_node(child)) {
+                push_node(&stack, child->first_child);
+                continue;
+            }
+            if (child->count == 0)
+                continue;
+
+            memcpy(xs + count, leaf_xs(tree, child), child->count * sizeof(float));
+            memcpy(ys + count, leaf_ys(tree, child), child->count * sizeof(float));
+            memcpy(ids + count, leaf_ids(tree, child), child->count * sizeof(uint64_t));
+            count += child->count;
         }
     }
+    destroy_node_stack(&stack);
+
+    assert(count == tree->nodes[node_index].count);
+    release_children(tree, node_index);
+    tree->nodes[node_index].bucket = bucket;
+    for (uint32_t i = 0; i < count; i++) {
+        if (ids[i] != QUAD_TREE_NO_ID)
+            hash_table_insert(&tree->id_slots, ids[i], bucket * tree->leaf_capacity + i);
+    }
 }
 
 Rect create_rect(float x, float y, float half_width, float half_height) {
@@ -112,13 +658,37 @@ Rect create_rect(float x, float y, float half_width, float half_height) {
 }
 
 QuadTree* create_new_tree(Rect bounds) {
+    return create_new_tree_with_leaf_capacity(bounds, QUAD_TREE_DEFAULT_LEAF_CAPACITY);
+}
+
+QuadTree* create_new_tree_with_leaf_capacity(Rect bounds, uint32_t leaf_capacity) {
+    assert(leaf_capacity > 0);
+
     QuadTree* tree = (QuadTree*)malloc(sizeof(QuadTree));
+    assert(tree != NULL);
     memset(tree, 0, sizeof(QuadTree));
-    tree->bounds = bounds;
-    tree->is_leaf = true;
+    increase_list_capacity((void**)&tree->nodes, &tree->node_capacity, sizeof(QuadTreeNode), INITIAL_NODE_CAPACITY);
+
+    initialize_node(&tree->nodes[0], bounds);
+    tree->node_count = 1;
+    tree->free_block = QUAD_TREE_NULL_NODE;
+    tree->leaf_capacity = leaf_capacity;
+    tree->bucket_size = leaf_capacity;
+    tree->max_depth = QUAD_TREE_DEFAULT_MAX_DEPTH;
+    reset_free_runs(tree);
     return tree;
 }
 
+void quad_tree_set_max_depth(QuadTree* tree, uint32_t max_depth) {
+    assert(tree != NULL);
+    tree->max_depth = max_depth;
+}
+
+void quad_tree_set_log_hook(QuadTreeLogHook hook, void* context) {
+    log_hook = hook;
+    log_hook_context = context;
+}
+
 bool is_point_inside_rect(Rect rect, Point point) {
     return (
         point.x >= rect.center.x - rect.half_width && point.x <= rect.center.x + rect.half_width && point.y >= rect.center.y - rect.half_height && point.y <= rect.center.y + rect.half_height);
@@ -135,177 +705,1846 @@ bool rects_intersect(Rect a, Rect b) {
         b.center.x - b.half_width > a.center.x + a.half_width || b.center.x + b.half_width < a.center.x - a.half_width || b.center.y - b.half_height > a.center.y + a.half_height || b.center.y + b.half_height < a.center.y - a.half_height);
 }
 
+static float squared_distance_to_rect(Rect rect, Point point) {
+    float nearest_x = fmaxf(rect.center.x - rect.half_width, fminf(point.x, rect.center.x + rect.half_width));
+    float nearest_y = fmaxf(rect.center.y - rect.half_height, fminf(point.y, rect.center.y + rect.half_height));
+    float dist_x = point.x - nearest_x;
+    float dist_y = point.y - nearest_y;
+    return (dist_x * dist_x) + (dist_y * dist_y);
+}
+
+static float squared_distance(Point a, Point b) {
+    float dist_x = a.x - b.x;
+    float dist_y = a.y - b.y;
+    return (dist_x * dist_x) + (dist_y * dist_y);
+}
+
 bool circle_rect_intersect(Circle circle, Rect rect) {
-    float nearest_x = fmaxf(rect.center.x - rect.half_width, fminf(circle.center.x, rect.center.x + rect.half_width));
-    float nearest_y = fmaxf(rect.center.y - rect.half_height, fminf(circle.center.y, rect.center.y + rect.half_height));
-    float dist_x = circle.center.x - nearest_x;
-    float dist_y = circle.center.y - nearest_y;
-    return ((dist_x * dist_x) + (dist_y * dist_y)) <= (circle.radius * circle.radius);
+    return squared_distance_to_rect(rect, circle.center) <= (circle.radius * circle.radius);
 }
 
-bool insert_point_into_quadtree(QuadTree* tree, Point point) {
-    if (!is_point_inside_rect(tree->bounds, point))
-        return false;
+// Leaf kernels. Each returns a bitmask with bit i set when point i of the
+// LEAF_LANES points at xs/ys matches; the scalar versions also cover the
+// tail of a leaf that does not fill a whole step.
+typedef struct QueryBox {
+    float min_x;
+    float max_x;
+    float min_y;
+    float max_y;
+} QueryBox;
 
-    bool success = false;
-    if (tree->is_leaf) {
-        for (int i = 0; i < tree->count; i++) {
-            if (tree->points[i].x == point.x && tree->points[i].y == point.y) {
-                fprintf(stderr, "Point %.2f, %.2f already exists in tree. Skipping...\n", point.x, point.y);
-                return false;
-            }
-        }
+static QueryBox query_box_from_rect(Rect range) {
+    QueryBox box = {
+        .min_x = range.center.x - range.half_width,
+        .max_x = range.center.x + range.half_width,
+        .min_y = range.center.y - range.half_height,
+        .max_y = range.center.y + range.half_height,
+    };
+    return box;
+}
 
-        if (tree->count < QUAD_TREE_MAX_POINTS) {
-            tree->points[tree->count] = point;
-            //++tree->count;
-            success = true;
-        }
-        else {
-            subdivide_quad_tree(tree);
-            return insert_point_into_quadtree(tree, point);
-        }
+static inline unsigned lowest_set_bit(uint32_t mask) {
+    assert(mask != 0);
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+static inline unsigned count_set_bits(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_popcount(mask);
+#else
+    unsigned count = 0;
+    for (; mask != 0; mask &= mask - 1) {
+        ++count;
     }
-    else {
-        for (int i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
-            success = insert_point_into_quadtree(tree->children[i], point);
-            if (success)
-                break;
-        }
+    return count;
+#endif
+}
+
+static inline uint32_t rect_match_scalar(const float* xs, const float* ys, uint32_t count, const QueryBox* box) {
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        bool inside = (xs[i] >= box->min_x) & (xs[i] <= box->max_x) & (ys[i] >= box->min_y) & (ys[i] <= box->max_y);
+        mask |= (uint32_t)inside << i;
     }
+    return mask;
+}
+
+static inline uint32_t rect_match(const float* xs, const float* ys, const QueryBox* box) {
+#if defined(QUAD_TREE_USE_AVX2)
+    __m256 x = _mm256_loadu_ps(xs);
+    __m256 y = _mm256_loadu_ps(ys);
+    __m256 inside_x = _mm256_and_ps(_mm256_cmp_ps(x, _mm256_set1_ps(box->min_x), _CMP_GE_OQ), _mm256_cmp_ps(x, _mm256_set1_ps(box->max_x), _CMP_LE_OQ));
+    __m256 inside_y = _mm256_and_ps(_mm256_cmp_ps(y, _mm256_set1_ps(box->min_y), _CMP_GE_OQ), _mm256_cmp_ps(y, _mm256_set1_ps(box->max_y), _CMP_LE_OQ));
+    return (uint32_t)_mm256_movemask_ps(_mm256_and_ps(inside_x, inside_y));
+#elif defined(QUAD_TREE_USE_SSE2)
+    __m128 x = _mm_loadu_ps(xs);
+    __m128 y = _mm_loadu_ps(ys);
+    __m128 inside_x = _mm_and_ps(_mm_cmpge_ps(x, _mm_set1_ps(box->min_x)), _mm_cmple_ps(x, _mm_set1_ps(box->max_x)));
+    __m128 inside_y = _mm_and_ps(_mm_cmpge_ps(y, _mm_set1_ps(box->min_y)), _mm_cmple_ps(y, _mm_set1_ps(box->max_y)));
+    return (uint32_t)_mm_movemask_ps(_mm_and_ps(inside_x, inside_y));
+#else
+    return rect_match_scalar(xs, ys, LEAF_LANES, box);
+#endif
+}
 
-    if (success) {
-        ++tree->count;
+// Same arithmetic as is_point_inside_circle, so both agree on the boundary.
+static inline uint32_t circle_match_scalar(const float* xs, const float* ys, uint32_t count, const Circle* circle) {
+    float radius_squared = circle->radius * circle->radius;
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        float dist_x = xs[i] - circle->center.x;
+        float dist_y = ys[i] - circle->center.y;
+        mask |= (uint32_t)(((dist_x * dist_x) + (dist_y * dist_y)) <= radius_squared) << i;
     }
-    return success;
+    return mask;
 }
 
-void free_quad_tree(QuadTree* tree) {
-    if (tree == NULL)
-        return;
+static inline uint32_t circle_match(const float* xs, const float* ys, const Circle* circle) {
+#if defined(QUAD_TREE_USE_AVX2)
+    __m256 dist_x = _mm256_sub_ps(_mm256_loadu_ps(xs), _mm256_set1_ps(circle->center.x));
+    __m256 dist_y = _mm256_sub_ps(_mm256_loadu_ps(ys), _mm256_set1_ps(circle->center.y));
+    __m256 distance = _mm256_add_ps(_mm256_mul_ps(dist_x, dist_x), _mm256_mul_ps(dist_y, dist_y));
+    return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(distance, _mm256_set1_ps(circle->radius * circle->radius), _CMP_LE_OQ));
+#elif defined(QUAD_TREE_USE_SSE2)
+    __m128 dist_x = _mm_sub_ps(_mm_loadu_ps(xs), _mm_set1_ps(circle->center.x));
+    __m128 dist_y = _mm_sub_ps(_mm_loadu_ps(ys), _mm_set1_ps(circle->center.y));
+    __m128 distance = _mm_add_ps(_mm_mul_ps(dist_x, dist_x), _mm_mul_ps(dist_y, dist_y));
+    return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(distance, _mm_set1_ps(circle->radius * circle->radius)));
+#else
+    return circle_match_scalar(xs, ys, LEAF_LANES, circle);
+#endif
+}
 
-    if (!tree->is_leaf) {
-        for (int i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
-            free_quad_tree(tree->children[i]);
-        }
+static inline void append_matches(const float* xs, const float* ys, uint32_t mask, Point* found, int* found_count, int max_count) {
+    while (mask != 0 && *found_count < max_count) {
+        unsigned lane = lowest_set_bit(mask);
+        found[*found_count] = (Point){.x = xs[lane], .y = ys[lane]};
+        (*found_count)++;
+        mask &= mask - 1;
     }
+}
 
-    fprintf(stderr, "Freeing Quad Tree\n");
-    free(tree);
+static uint32_t find_leaf(const QuadTree* tree, Point point) {
+    uint32_t node_index = 0;
+    while (!is_leaf_node(&tree->nodes[node_index])) {
+        node_index = child_containing(&tree->nodes[node_index], point);
+    }
+    return node_index;
 }
 
-void search_space_in_tree(const QuadTree* tree, Rect range, Point* found, int* found_count, int max_count) {
-    if (!rects_intersect(tree->bounds, range))
-        return;
+// A box with no extent matches exactly the points equal to point.
+static int find_point_in_leaf(const QuadTree* tree, const QuadTreeNode* node, Point point) {
+    assert(is_leaf_node(node));
+    if (node->count == 0)
+        return -1;
 
-    if (tree->is_leaf) {
-        for (int i = 0; i < tree->count; i++) {
-            Point point = tree->points[i];
-            if (!is_point_inside_rect(range, point))
-                continue;
+    const float* xs = leaf_xs(tree, node);
+    const float* ys = leaf_ys(tree, node);
+    QueryBox box = {.min_x = point.x, .max_x = point.x, .min_y = point.y, .max_y = point.y};
+    uint32_t i = 0;
+    uint32_t mask = 0;
+    for (; i + LEAF_LANES <= node->count && mask == 0; i += LEAF_LANES) {
+        mask = rect_match(xs + i, ys + i, &box);
+    }
+    if (mask != 0)
+        return (int)(i - LEAF_LANES + lowest_set_bit(mask));
+    if (i < node->count)
+        mask = rect_match_scalar(xs + i, ys + i, node->count - i, &box);
+    return mask != 0 ? (int)(i + lowest_set_bit(mask)) : -1;
+}
 
-            if (*found_count < max_count) {
-                found[*found_count] = point;
-                (*found_count)++;
-            }
-            else {
-                return;
+typedef struct MortonPoint {
+    uint32_t code;
+    Point point;
+} MortonPoint;
+
+// Z-order keys of points below bounds, two bits per level in child order.
+// The digits come from walking the same float centers subdivide_quad_tree
+// produces, rather than from interleaving quantized coordinates, so every
+// point sorts into exactly the child that child_quadrant would pick. Points
+// are walked a batch at a time, level by level, so the compiler can overlap
+// the independent per-point chains instead of stalling on each one.
+static void compute_morton_codes(Rect bounds, MortonPoint* items, size_t count) {
+    for (size_t start = 0; start < count; start += MORTON_BATCH_SIZE) {
+        size_t batch_count = (count - start) < MORTON_BATCH_SIZE ? (count - start) : MORTON_BATCH_SIZE;
+        MortonPoint* batch = items + start;
+
+        float x[MORTON_BATCH_SIZE], y[MORTON_BATCH_SIZE];
+        float cx[MORTON_BATCH_SIZE], cy[MORTON_BATCH_SIZE];
+        uint32_t codes[MORTON_BATCH_SIZE];
+        for (size_t i = 0; i < batch_count; i++) {
+            x[i] = batch[i].point.x;
+            y[i] = batch[i].point.y;
+            cx[i] = bounds.center.x;
+            cy[i] = bounds.center.y;
+            codes[i] = 0;
+        }
+
+        float hw = bounds.half_width;
+        float hh = bounds.half_height;
+        for (int level = 0; level < MORTON_LEVELS; level++) {
+            hw = hw / 2.0f;
+            hh = hh / 2.0f;
+            for (size_t i = 0; i < batch_count; i++) {
+                bool west = x[i] < cx[i];
+                bool south = y[i] > cy[i];
+                codes[i] = (codes[i] << 2) | (west ? QUAD_TREE_INDEX_NW : 0) | (south ? QUAD_TREE_INDEX_SE : 0);
+                cx[i] += west ? -hw : hw;
+                cy[i] += south ? hh : -hh;
             }
         }
-    }
-    else {
-        for (int i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
-            search_space_in_tree(tree->children[i], range, found, found_count, max_count);
+
+        for (size_t i = 0; i < batch_count; i++) {
+            batch[i].code = codes[i];
         }
     }
 }
 
-void search_circle_in_tree(const QuadTree* tree, Circle range, Point* found, int* found_count, int max_count) {
-    if (!circle_rect_intersect(range, tree->bounds))
-        return;
+// LSD radix sort on the codes. Digits that every key shares are skipped,
+// which drops most passes for small inputs and for deep re-sorts.
+static void sort_by_morton_code(MortonPoint* items, MortonPoint* scratch, size_t count) {
+    uint32_t varying_bits = 0;
+    for (size_t i = 1; i < count; i++) {
+        varying_bits |= items[i].code ^ items[0].code;
+    }
 
-    if (tree->is_leaf) {
-        for (int i = 0; i < tree->count; i++) {
-            Point point = tree->points[i];
-            if (!is_point_inside_circle(range, point))
-                continue;
+    for (unsigned shift = 0; shift < 32; shift += RADIX_BITS) {
+        if (((varying_bits >> shift) & ((1u << RADIX_BITS) - 1)) == 0)
+            continue;
 
-            if (*found_count < max_count) {
-                found[*found_count] = point;
-                (*found_count)++;
-            }
-            else {
-                return;
-            }
+        size_t offsets[1 << RADIX_BITS] = {0};
+        for (size_t i = 0; i < count; i++) {
+            ++offsets[(items[i].code >> shift) & ((1u << RADIX_BITS) - 1)];
+        }
+        size_t offset = 0;
+        for (size_t digit = 0; digit < (1 << RADIX_BITS); digit++) {
+            size_t digit_count = offsets[digit];
+            offsets[digit] = offset;
+            offset += digit_count;
         }
+        for (size_t i = 0; i < count; i++) {
+            scratch[offsets[(items[i].code >> shift) & ((1u << RADIX_BITS) - 1)]++] = items[i];
+        }
+        memcpy(items, scratch, count * sizeof(MortonPoint));
     }
-    else {
-        for (int i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
-            search_circle_in_tree(tree->children[i], range, found, found_count, max_count);
+}
+
+// Drops repeated points, which would otherwise subdivide forever. Equal
+// points have equal codes, so only runs of equal codes need checking.
+static size_t remove_duplicate_points(MortonPoint* items, size_t count) {
+    size_t kept = 0;
+    size_t run_start = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (kept > 0 && items[kept - 1].code != items[i].code)
+            run_start = kept;
+
+        bool is_duplicate = false;
+        for (size_t j = run_start; j < kept && !is_duplicate; j++) {
+            is_duplicate = items[j].point.x == items[i].point.x && items[j].point.y == items[i].point.y;
         }
+        if (!is_duplicate)
+            items[kept++] = items[i];
     }
+    return kept;
 }
 
-void print_quad_tree(const QuadTree* tree, int level) {
-    if (tree == NULL) return;
-    for (int i = 0; i < level; i++) {
-        fprintf(stderr, "  ");
+typedef struct BulkBuildTask {
+    uint32_t node_index;
+    size_t begin;
+    size_t end;
+    int level;
+    uint32_t depth;
+} BulkBuildTask;
+
+typedef struct BulkBuildStack {
+    BulkBuildTask* items;
+    size_t count;
+    size_t capacity;
+} BulkBuildStack;
+
+static void push_bulk_build_task(BulkBuildStack* stack, BulkBuildTask task) {
+    if (stack->count == stack->capacity)
+        increase_list_capacity((void**)&stack->items, &stack->capacity, sizeof(BulkBuildTask), stack->capacity > 0 ? stack->capacity : 64);
+    stack->items[stack->count++] = task;
+}
+
+static size_t lower_bound_digit(const MortonPoint* items, size_t begin, size_t end, int level, uint32_t digit) {
+    unsigned shift = 2 * (MORTON_LEVELS - 1 - level);
+    while (begin < end) {
+        size_t middle = begin + (end - begin) / 2;
+        if (((items[middle].code >> shift) & 3) < digit)
+            begin = middle + 1;
+        else
+            end = middle;
     }
+    return begin;
+}
+
+QuadTree* quad_tree_build_bulk(Rect bounds, const Point* points, size_t count, uint32_t leaf_capacity) {
+    assert(points != NULL || count == 0);
+
+    QuadTree* tree = create_new_tree_with_leaf_capacity(bounds, leaf_capacity > 0 ? leaf_capacity : QUAD_TREE_DEFAULT_LEAF_CAPACITY);
+    MortonPoint* items = (MortonPoint*)malloc((count > 0 ? count : 1) * sizeof(MortonPoint));
+    MortonPoint* scratch = (MortonPoint*)malloc((count > 0 ? count : 1) * sizeof(MortonPoint));
+    assert(items != NULL && scratch != NULL);
+
+    size_t inside_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!is_point_inside_rect(bounds, points[i]))
+            continue;
+        items[inside_count].point = points[i];
+        ++inside_count;
+    }
+    compute_morton_codes(bounds, items, inside_count);
+    sort_by_morton_code(items, scratch, inside_count);
+    inside_count = remove_duplicate_points(items, inside_count);
 
-    fprintf(stderr, "Node at (%.2f, %.2f), half_w=%.2f, half_h=%.2f, leaf=%d, count=%d\n", tree->bounds.center.x, tree->bounds.center.y, tree->bounds.half_width, tree->bounds.half_height, tree->is_leaf, tree->count);
+    // Each node owns a contiguous run of the sorted points. Children are
+    // allocated in the order they are visited, so the pool ends up in
+    // Z-order as well.
+    BulkBuildStack stack = {0};
+    push_bulk_build_task(&stack, (BulkBuildTask){.node_index = 0, .begin = 0, .end = inside_count, .level = 0});
+    while (stack.count > 0) {
+        BulkBuildTask task = stack.items[--stack.count];
+        size_t task_count = task.end - task.begin;
+        QuadTreeNode* node = &tree->nodes[task.node_index];
+        assert(task_count <= UINT32_MAX);
 
-    if (tree->is_leaf) {
-        for (int i = 0; i < tree->count; i++) {
-            for (int j = 0; j < level + 1; j++) {
-                fprintf(stderr, "  ");
+        if (task_count <= tree->leaf_capacity || !can_subdivide(tree, node, task.depth)) {
+            for (size_t i = 0; i < task_count; i++) {
+                append_point_to_leaf(tree, task.node_index, items[task.begin + i].point, QUAD_TREE_NO_ID);
             }
-            fprintf(stderr, "Point: (%.2f, %.2f)\n", tree->points[i].x, tree->points[i].y);
+            continue;
         }
-    }
-    else {
-        for (int i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
-            print_quad_tree(tree->children[i], level + 1);
+        node->count = (uint32_t)task_count;
+
+        // Past the last digit of the codes, start over relative to this node.
+        if (task.level == MORTON_LEVELS) {
+            compute_morton_codes(node->bounds, items + task.begin, task_count);
+            sort_by_morton_code(items + task.begin, scratch, task_count);
+            task.level = 0;
+        }
+
+        uint32_t block = create_children(tree, task.node_index);
+        size_t child_begin[QUAD_TREE_MAX_CHILDREN + 1];
+        child_begin[0] = task.begin;
+        child_begin[QUAD_TREE_MAX_CHILDREN] = task.end;
+        for (uint32_t i = 1; i < QUAD_TREE_MAX_CHILDREN; i++) {
+            child_begin[i] = lower_bound_digit(items, child_begin[i - 1], task.end, task.level, i);
+        }
+
+        for (uint32_t i = QUAD_TREE_MAX_CHILDREN; i > 0; i--) {
+            push_bulk_build_task(&stack, (BulkBuildTask){
+                .node_index = block + i - 1,
+                .begin = child_begin[i - 1],
+                .end = child_begin[i],
+                .level = task.level + 1,
+                .depth = task.depth + 1,
+            });
         }
     }
-}
 
-static bool remove_point_from_leaf(QuadTree* tree, Point point) {
-    assert(tree->is_leaf);
-    for (int i = 0; i < tree->count; i++) {
-        if (tree->points[i].x != point.x || tree->points[i].y != point.y)
-            continue;
+    free(stack.items);
+    free(scratch);
+    free(items);
+    return tree;
+}
 
-        for (int j = i; j < tree->count - 1; j++) {
-            tree->points[j] = tree->points[j + 1];
+// Places a point somewhere below node_index, which sits at depth, bumping
+// the count of every node on the way down. The caller has already checked
+// for duplicates.
+static void insert_point_below(QuadTree* tree, uint32_t node_index, uint32_t depth, Point point, uint64_t id) {
+    for (;; ++depth) {
+        QuadTreeNode* node = &tree->nodes[node_index];
+        if (is_leaf_full(tree, node) && can_subdivide(tree, node, depth)) {
+            subdivide_quad_tree(tree, node_index);
+            node = &tree->nodes[node_index];
         }
 
-        return true;
+        if (is_leaf_node(node)) {
+            append_point_to_leaf(tree, node_index, point, id);
+            return;
+        }
+        ++node->count;
+        node_index = child_containing(node, point);
     }
-    return false;
 }
 
-bool remove_point_from_quad_tree(QuadTree* tree, Point point) {
-    if (!is_point_inside_rect(tree->bounds, point))
+static bool insert_point_with_id(QuadTree* tree, Point point, uint64_t id) {
+    if (tree->frozen || !is_point_inside_rect(tree->nodes[0].bounds, point))
         return false;
 
-    bool success = false;
-    if (tree->is_leaf) {
-        success = remove_point_from_leaf(tree, point);
-    }
-    else {
-        for (int i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
-            success = remove_point_from_quad_tree(tree->children[i], point);
-            if (success)
-                break;
-        }
+    // Look for a duplicate first so that the counts on the way down can be
+    // bumped in the same pass that places the point.
+    if (find_point_in_leaf(tree, &tree->nodes[find_leaf(tree, point)], point) >= 0) {
+        QUAD_TREE_LOG("Point %.2f, %.2f already exists in tree", point.x, point.y);
+        return false;
     }
 
-    if (success) {
-        --tree->count;
-        try_balance_quad_tree(tree);
-    }
-    else {
-        fprintf(stderr, "Failed to remove point %.2f, %.2f\n", point.x, point.y);
+    insert_point_below(tree, 0, 0, point, id);
+    return true;
+}
+
+bool insert_point_into_quadtree(QuadTree* tree, Point point) {
+    assert(tree != NULL);
+    return insert_point_with_id(tree, point, QUAD_TREE_NO_ID);
+}
+
+bool quad_tree_insert_with_id(QuadTree* tree, Point point, uint64_t id) {
+    assert(tree != NULL && id != QUAD_TREE_NO_ID);
+    if (!has_id_slots(tree))
+        initialize_hash_table(&tree->id_slots);
+    else if (hash_table_contains_key(&tree->id_slots, id))
+        return false;
+    return insert_point_with_id(tree, point, id);
+}
+
+// Deepest node on the path from the root to leaf_index that routing would
+// still send point through. Walks the whole path and compares with the
+// same child_quadrant tests as find_leaf, since edges recomputed from a
+// node's center and half size round differently from its parent's center.
+static uint32_t routing_ancestor(const QuadTree* tree, uint32_t leaf_index, Point point) {
+    uint32_t ancestor = leaf_index;
+    for (uint32_t node_index = leaf_index; tree->nodes[node_index].parent != QUAD_TREE_NULL_NODE; node_index = tree->nodes[node_index].parent) {
+        uint32_t parent = tree->nodes[node_index].parent;
+        if (child_containing(&tree->nodes[parent], point) != node_index)
+            ancestor = parent;
     }
-    return success;
-}
\ No newline at end of file
+    return ancestor;
+}
+
+static bool find_id(const QuadTree* tree, uint64_t id, uint32_t* leaf_index, uint32_t* point_index) {
+    if (!has_id_slots(tree))
+        return false;
+
+    uint32_t slot;
+    bool found;
+    hash_table_get_entries_batch(&tree->id_slots, &id, 1, &slot, &found);
+    if (!found)
+        return false;
+
+    *leaf_index = tree->bucket_nodes[slot / tree->leaf_capacity];
+    *point_index = slot - tree->nodes[*leaf_index].bucket * tree->leaf_capacity;
+    assert(tree->ids[slot] == id);
+    return true;
+}
+
+bool quad_tree_move(QuadTree* tree, uint64_t id, Point position) {
+    assert(tree != NULL);
+    uint32_t leaf_index;
+    uint32_t point_index;
+    if (tree->frozen || !is_point_inside_rect(tree->nodes[0].bounds, position) || !find_id(tree, id, &leaf_index, &point_index))
+        return false;
+
+    // Only the nodes below the last point where the old and new routes
+    // agree change, so descend from there.
+    uint32_t ancestor = routing_ancestor(tree, leaf_index, position);
+    uint32_t target = ancestor;
+    while (!is_leaf_node(&tree->nodes[target])) {
+        target = child_containing(&tree->nodes[target], position);
+    }
+
+    int existing = find_point_in_leaf(tree, &tree->nodes[target], position);
+    if (existing >= 0)
+        return target == leaf_index && (uint32_t)existing == point_index;
+
+    if (target == leaf_index) {
+        leaf_xs(tree, &tree->nodes[leaf_index])[point_index] = position.x;
+        leaf_ys(tree, &tree->nodes[leaf_index])[point_index] = position.y;
+        return true;
+    }
+
+    // The ancestor loses the point and gets it back, so it is decremented
+    // here and bumped again by insert_point_below.
+    remove_point_from_leaf(tree, &tree->nodes[leaf_index], point_index);
+    uint32_t node_index = leaf_index;
+    do {
+        node_index = tree->nodes[node_index].parent;
+        --tree->nodes[node_index].count;
+    } while (node_index != ancestor);
+
+    insert_point_below(tree, ancestor, node_depth(tree, ancestor), position, id);
+    return true;
+}
+
+bool quad_tree_remove_id(QuadTree* tree, uint64_t id) {
+    assert(tree != NULL);
+    uint32_t leaf_index;
+    uint32_t point_index;
+    if (tree->frozen || !find_id(tree, id, &leaf_index, &point_index))
+        return false;
+
+    remove_point_from_leaf(tree, &tree->nodes[leaf_index], point_index);
+    for (uint32_t node_index = tree->nodes[leaf_index].parent; node_index != QUAD_TREE_NULL_NODE; node_index = tree->nodes[node_index].parent) {
+        --tree->nodes[node_index].count;
+    }
+    hash_table_delete_entry(&tree->id_slots, id);
+    return true;
+}
+
+bool quad_tree_find_id(const QuadTree* tree, uint64_t id, Point* position) {
+    assert(tree != NULL && position != NULL);
+    uint32_t leaf_index;
+    uint32_t point_index;
+    if (!find_id(tree, id, &leaf_index, &point_index))
+        return false;
+
+    *position = leaf_point(tree, &tree->nodes[leaf_index], point_index);
+    return true;
+}
+
+// Once leaves hold less than half of the bucket arrays, packs their runs
+// back to back, longest first so that each stays aligned to its length,
+// and drops the free runs and spare capacity. Only leaves have a bucket,
+// so the pool can be scanned without walking the tree.
+static void compact_buckets(QuadTree* tree) {
+    size_t class_starts[QUAD_TREE_BUCKET_RUN_CLASSES] = {0};
+    for (size_t i = 0; i < tree->node_count; i++) {
+        const QuadTreeNode* node = &tree->nodes[i];
+        if (node->bucket == QUAD_TREE_NULL_NODE)
+            continue;
+        uint32_t run = leaf_bucket_run(tree, node->count);
+        class_starts[run_class(run)] += run;
+    }
+    size_t bucket_count = 0;
+    for (uint32_t size_class = QUAD_TREE_BUCKET_RUN_CLASSES; size_class-- > 0;) {
+        size_t buckets = class_starts[size_class];
+        class_starts[size_class] = bucket_count;
+        bucket_count += buckets;
+    }
+    if (2 * bucket_count >= tree->bucket_capacity)
+        return;
+
+    float* xs = NULL;
+    float* ys = NULL;
+    uint64_t* ids = NULL;
+    uint32_t* bucket_nodes = NULL;
+    if (bucket_count > 0) {
+        xs = (float*)malloc(bucket_count * tree->leaf_capacity * sizeof(float));
+        ys = (float*)malloc(bucket_count * tree->leaf_capacity * sizeof(float));
+        ids = (uint64_t*)malloc(bucket_count * tree->leaf_capacity * sizeof(uint64_t));
+        bucket_nodes = (uint32_t*)malloc(bucket_count * sizeof(uint32_t));
+        assert(xs != NULL && ys != NULL && ids != NULL && bucket_nodes != NULL);
+    }
+
+    for (size_t i = 0; i < tree->node_count; i++) {
+        QuadTreeNode* node = &tree->nodes[i];
+        if (node->bucket == QUAD_TREE_NULL_NODE)
+            continue;
+
+        uint32_t run = leaf_bucket_run(tree, node->count);
+        uint32_t bucket = (uint32_t)class_starts[run_class(run)];
+        class_starts[run_class(run)] += run;
+        size_t first_slot = (size_t)bucket * tree->leaf_capacity;
+        memcpy(xs + first_slot, leaf_xs(tree, node), node->count * sizeof(float));
+        memcpy(ys + first_slot, leaf_ys(tree, node), node->count * sizeof(float));
+        memcpy(ids + first_slot, leaf_ids(tree, node), node->count * sizeof(uint64_t));
+        for (uint32_t j = 0; j < run; j++) {
+            bucket_nodes[bucket + j] = (uint32_t)i;
+        }
+        node->bucket = bucket;
+        for (uint32_t j = 0; j < node->count; j++) {
+            if (ids[first_slot + j] != QUAD_TREE_NO_ID)
+                hash_table_insert(&tree->id_slots, ids[first_slot + j], (uint32_t)(first_slot + j));
+        }
+    }
+
+    free(tree->bucket_nodes);
+    free(tree->ids);
+    free(tree->ys);
+    free(tree->xs);
+    tree->xs = xs;
+    tree->ys = ys;
+    tree->ids = ids;
+    tree->bucket_nodes = bucket_nodes;
+    tree->bucket_count = bucket_count;
+    tree->bucket_capacity = bucket_count;
+    reset_free_runs(tree);
+}
+
+// Collapses every node whose points fit in one leaf. Only nodes that still
+// have more points than that are descended into, so the pass is bounded by
+// the internal nodes that stay. The bucket arrays are compacted afterwards.
+void quad_tree_rebalance(QuadTree* tree) {
+    assert(tree != NULL);
+    if (tree->frozen)
+        return;
+
+    NodeStack stack;
+    initialize_node_stack(&stack);
+    push_node(&stack, 0);
+
+    while (stack.count > 0) {
+        uint32_t node_index = pop_node(&stack);
+        const QuadTreeNode* node = &tree->nodes[node_index];
+        if (is_leaf_node(node))
+            continue;
+        if (node->count <= tree->leaf_capacity) {
+            collapse_quad_tree_node(tree, node_index);
+            continue;
+        }
+        push_children(&stack, node->first_child);
+    }
+    destroy_node_stack(&stack);
+    compact_buckets(tree);
+}
+
+void quad_tree_freeze(QuadTree* tree) {
+    assert(tree != NULL);
+    tree->frozen = true;
+}
+
+void quad_tree_unfreeze(QuadTree* tree) {
+    assert(tree != NULL && tree->mapping.data == NULL);
+    tree->frozen = false;
+}
+
+// The pool is a single allocation, so this does not depend on tree size.
+void free_quad_tree(QuadTree* tree) {
+    if (tree == NULL)
+        return;
+
+    if (tree->mapping.data != NULL) {
+        close_file_mapping(&tree->mapping);
+        free(tree);
+        return;
+    }
+
+    destroy_hash_table(&tree->id_slots);
+    free(tree->bucket_nodes);
+    free(tree->ids);
+    free(tree->ys);
+    free(tree->xs);
+    free(tree->nodes);
+    free(tree);
+}
+
+void quad_tree_clear(QuadTree* tree) {
+    assert(tree != NULL);
+    if (tree->frozen)
+        return;
+
+    initialize_node(&tree->nodes[0], tree->nodes[0].bounds);
+    tree->node_count = 1;
+    tree->free_block = QUAD_TREE_NULL_NODE;
+    tree->bucket_count = 0;
+    reset_free_runs(tree);
+    destroy_hash_table(&tree->id_slots);
+}
+
+// Nodes are copied breadth-first, sibling blocks staying together, and each
+// leaf's points are appended to the packed arrays as the leaf is reached.
+bool quad_tree_save(const QuadTree* tree, const char* path) {
+    assert(tree != NULL && path != NULL);
+
+    size_t point_count = tree->nodes[0].count;
+    QuadTreeNode* nodes = (QuadTreeNode*)malloc(tree->node_count * sizeof(QuadTreeNode));
+    uint64_t* ids = (uint64_t*)malloc((point_count > 0 ? point_count : 1) * sizeof(uint64_t));
+    float* xs = (float*)malloc((point_count > 0 ? point_count : 1) * sizeof(float));
+    float* ys = (float*)malloc((point_count > 0 ? point_count : 1) * sizeof(float));
+    assert(nodes != NULL && ids != NULL && xs != NULL && ys != NULL);
+
+    nodes[0] = tree->nodes[0];
+    nodes[0].parent = QUAD_TREE_NULL_NODE;
+    size_t node_count = 1;
+    size_t slot = 0;
+    for (size_t i = 0; i < node_count; i++) {
+        QuadTreeNode* node = &nodes[i];
+        if (!is_leaf_node(node)) {
+            uint32_t first_child = (uint32_t)node_count;
+            for (uint32_t j = 0; j < QUAD_TREE_MAX_CHILDREN; j++) {
+                nodes[node_count] = tree->nodes[node->first_child + j];
+                nodes[node_count].parent = (uint32_t)i;
+                ++node_count;
+            }
+            node->first_child = first_child;
+            continue;
+        }
+        if (node->count == 0) {
+            node->bucket = QUAD_TREE_NULL_NODE;
+            continue;
+        }
+
+        memcpy(ids + slot, leaf_ids(tree, node), node->count * sizeof(uint64_t));
+        memcpy(xs + slot, leaf_xs(tree, node), node->count * sizeof(float));
+        memcpy(ys + slot, leaf_ys(tree, node), node->count * sizeof(float));
+        node->bucket = (uint32_t)slot;
+        slot += node->count;
+    }
+    assert(slot == point_count);
+
+    SnapshotHeader header = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .byte_order = SNAPSHOT_BYTE_ORDER,
+        .node_size = sizeof(QuadTreeNode),
+        .leaf_capacity = tree->leaf_capacity,
+        .node_count = node_count,
+        .point_count = point_count,
+    };
+    uint8_t header_bytes[SNAPSHOT_HEADER_SIZE] = {0};
+    memcpy(header_bytes, &header, sizeof(header));
+
+    bool success = false;
+    FILE* file = fopen(path, "wb");
+    if (file != NULL) {
+        // ids come before the floats so that every array stays aligned.
+        success = fwrite(header_bytes, 1, sizeof(header_bytes), file) == sizeof(header_bytes)
+                  && fwrite(nodes, sizeof(QuadTreeNode), node_count, file) == node_count
+                  && fwrite(ids, sizeof(uint64_t), point_count, file) == point_count
+                  && fwrite(xs, sizeof(float), point_count, file) == point_count
+                  && fwrite(ys, sizeof(float), point_count, file) == point_count;
+        success &= fclose(file) == 0;
+    }
+
+    free(ys);
+    free(xs);
+    free(ids);
+    free(nodes);
+    return success;
+}
+
+// Checks every index a query would follow before the tree is handed out.
+// Children must come after their parent, as save writes them, which also
+// rules out cycles, and every leaf must stay inside the packed points.
+static bool are_snapshot_nodes_valid(const QuadTreeNode* nodes, size_t node_count, size_t point_count) {
+    for (size_t i = 0; i < node_count; i++) {
+        const QuadTreeNode* node = &nodes[i];
+        if (is_leaf_node(node)) {
+            if (node->count > 0 && (size_t)node->bucket + node->count > point_count)
+                return false;
+        }
+        else if (node->first_child <= i || (size_t)node->first_child + QUAD_TREE_MAX_CHILDREN > node_count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QuadTree* quad_tree_open_mapped(const char* path) {
+    assert(path != NULL);
+
+    FileMapping mapping;
+    if (!open_file_mapping(&mapping, path, false))
+        return NULL;
+
+    SnapshotHeader header;
+    bool valid = mapping.size >= SNAPSHOT_HEADER_SIZE;
+    if (valid) {
+        memcpy(&header, mapping.data, sizeof(header));
+        valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0
+                && header.version == SNAPSHOT_VERSION
+                && header.byte_order == SNAPSHOT_BYTE_ORDER
+                && header.node_size == sizeof(QuadTreeNode)
+                && header.leaf_capacity > 0
+                && header.node_count > 0
+                && header.node_count < QUAD_TREE_NULL_NODE
+                && header.point_count < UINT32_MAX
+                && mapping.size == SNAPSHOT_HEADER_SIZE + header.node_count * sizeof(QuadTreeNode) + header.point_count * (sizeof(uint64_t) + 2 * sizeof(float))
+                && are_snapshot_nodes_valid((const QuadTreeNode*)((uint8_t*)mapping.data + SNAPSHOT_HEADER_SIZE), (size_t)header.node_count, (size_t)header.point_count);
+    }
+    if (!valid) {
+        close_file_mapping(&mapping);
+        return NULL;
+    }
+
+    QuadTree* tree = (QuadTree*)malloc(sizeof(QuadTree));
+    assert(tree != NULL);
+    memset(tree, 0, sizeof(QuadTree));
+
+    size_t node_count = (size_t)header.node_count;
+    size_t point_count = (size_t)header.point_count;
+    uint8_t* block = (uint8_t*)mapping.data + SNAPSHOT_HEADER_SIZE;
+    tree->nodes = (QuadTreeNode*)block;
+    tree->node_count = node_count;
+    tree->node_capacity = node_count;
+    tree->free_block = QUAD_TREE_NULL_NODE;
+    tree->leaf_capacity = header.leaf_capacity;
+    tree->bucket_size = 1;
+    block += node_count * sizeof(QuadTreeNode);
+    tree->ids = (uint64_t*)block;
+    tree->xs = (float*)(block + point_count * sizeof(uint64_t));
+    tree->ys = (float*)(block + point_count * (sizeof(uint64_t) + sizeof(float)));
+    reset_free_runs(tree);
+    tree->frozen = true;
+    tree->mapping = mapping;
+    return tree;
+}
+
+static void filter_leaf_in_rect(const QuadTree* tree, const QuadTreeNode* node, const QueryBox* box, Point* found, int* found_count, int max_count) {
+    STATS_COUNT_POINTS(node->count);
+    const float* xs = leaf_xs(tree, node);
+    const float* ys = leaf_ys(tree, node);
+    uint32_t i = 0;
+    for (; i + LEAF_LANES <= node->count && *found_count < max_count; i += LEAF_LANES) {
+        append_matches(xs + i, ys + i, rect_match(xs + i, ys + i, box), found, found_count, max_count);
+    }
+    if (i < node->count && *found_count < max_count)
+        append_matches(xs + i, ys + i, rect_match_scalar(xs + i, ys + i, node->count - i, box), found, found_count, max_count);
+}
+
+static void filter_leaf_in_circle(const QuadTree* tree, const QuadTreeNode* node, const Circle* circle, Point* found, int* found_count, int max_count) {
+    STATS_COUNT_POINTS(node->count);
+    const float* xs = leaf_xs(tree, node);
+    const float* ys = leaf_ys(tree, node);
+    uint32_t i = 0;
+    for (; i + LEAF_LANES <= node->count && *found_count < max_count; i += LEAF_LANES) {
+        append_matches(xs + i, ys + i, circle_match(xs + i, ys + i, circle), found, found_count, max_count);
+    }
+    if (i < node->count && *found_count < max_count)
+        append_matches(xs + i, ys + i, circle_match_scalar(xs + i, ys + i, node->count - i, circle), found, found_count, max_count);
+}
+
+// Copies out every point below node_index without testing any of them, for
+// nodes that lie fully inside the query.
+static void append_subtree(const QuadTree* tree, uint32_t node_index, Point* found, int* found_count, int max_count) {
+    NodeStack stack;
+    initialize_node_stack(&stack);
+    push_node(&stack, node_index);
+
+    while (stack.count > 0 && *found_count < max_count) {
+        const QuadTreeNode* node = &tree->nodes[pop_node(&stack)];
+        if (node->count == 0)
+            continue;
+        if (!is_leaf_node(node)) {
+            STATS_COUNT_NODES(QUAD_TREE_MAX_CHILDREN);
+            push_children(&stack, node->first_child);
+            continue;
+        }
+
+        const float* xs = leaf_xs(tree, node);
+        const float* ys = leaf_ys(tree, node);
+        uint32_t count = node->count;
+        if ((size_t)count > (size_t)(max_count - *found_count))
+            count = (uint32_t)(max_count - *found_count);
+        STATS_COUNT_POINTS(count);
+        Point* out = found + *found_count;
+        for (uint32_t i = 0; i < count; i++) {
+            out[i] = (Point){.x = xs[i], .y = ys[i]};
+        }
+        *found_count += (int)count;
+    }
+    destroy_node_stack(&stack);
+}
+
+static bool is_rect_inside_box(Rect rect, const QueryBox* box) {
+    return rect.center.x - rect.half_width >= box->min_x && rect.center.x + rect.half_width <= box->max_x && rect.center.y - rect.half_height >= box->min_y && rect.center.y + rect.half_height <= box->max_y;
+}
+
+// The rect is inside the circle when its furthest corner is.
+static bool is_rect_inside_circle(Rect rect, Circle circle) {
+    Point corner = {
+        .x = circle.center.x < rect.center.x ? rect.center.x + rect.half_width : rect.center.x - rect.half_width,
+        .y = circle.center.y < rect.center.y ? rect.center.y + rect.half_height : rect.center.y - rect.half_height,
+    };
+    return is_point_inside_circle(circle, corner);
+}
+
+void search_space_in_tree(const QuadTree* tree, Rect range, Point* found, int* found_count, int max_count) {
+    assert(tree != NULL);
+    if (!rects_intersect(tree->nodes[0].bounds, range))
+        return;
+
+    QueryBox box = query_box_from_rect(range);
+
+    NodeStack stack;
+    initialize_node_stack(&stack);
+    push_node(&stack, 0);
+
+    while (stack.count > 0 && *found_count < max_count) {
+        uint32_t node_index = pop_node(&stack);
+        const QuadTreeNode* node = &tree->nodes[node_index];
+        STATS_COUNT_NODES(1);
+        if (node->count == 0)
+            continue;
+        if (is_rect_inside_box(node->bounds, &box)) {
+            append_subtree(tree, node_index, found, found_count, max_count);
+            continue;
+        }
+        if (is_leaf_node(node)) {
+            filter_leaf_in_rect(tree, node, &box, found, found_count, max_count);
+            continue;
+        }
+
+        // Same split as child_quadrant: the east and north halves own the
+        // center lines.
+        float cx = node->bounds.center.x;
+        float cy = node->bounds.center.y;
+        bool west = box.min_x < cx;
+        bool east = box.max_x >= cx;
+        bool north = box.min_y <= cy;
+        bool south = box.max_y > cy;
+        if (south && west)
+            push_node(&stack, node->first_child + QUAD_TREE_INDEX_SW);
+        if (south && east)
+            push_node(&stack, node->first_child + QUAD_TREE_INDEX_SE);
+        if (north && west)
+            push_node(&stack, node->first_child + QUAD_TREE_INDEX_NW);
+        if (north && east)
+            push_node(&stack, node->first_child + QUAD_TREE_INDEX_NE);
+    }
+    destroy_node_stack(&stack);
+}
+
+void search_circle_in_tree(const QuadTree* tree, Circle range, Point* found, int* found_count, int max_count) {
+    assert(tree != NULL);
+
+    NodeStack stack;
+    initialize_node_stack(&stack);
+    push_node(&stack, 0);
+
+    while (stack.count > 0 && *found_count < max_count) {
+        uint32_t node_index = pop_node(&stack);
+        const QuadTreeNode* node = &tree->nodes[node_index];
+        STATS_COUNT_NODES(1);
+        if (node->count == 0 || !circle_rect_intersect(range, node->bounds))
+            continue;
+        if (is_rect_inside_circle(node->bounds, range)) {
+            append_subtree(tree, node_index, found, found_count, max_count);
+            continue;
+        }
+        if (is_leaf_node(node)) {
+            filter_leaf_in_circle(tree, node, &range, found, found_count, max_count);
+            continue;
+        }
+        push_children(&stack, node->first_child);
+    }
+    destroy_node_stack(&stack);
+}
+
+static size_t count_leaf_in_rect(const QuadTree* tree, const QuadTreeNode* node, const QueryBox* box) {
+    STATS_COUNT_POINTS(node->count);
+    const float* xs = leaf_xs(tree, node);
+    const float* ys = leaf_ys(tree, node);
+    size_t count = 0;
+    uint32_t i = 0;
+    for (; i + LEAF_LANES <= node->count; i += LEAF_LANES) {
+        count += count_set_bits(rect_match(xs + i, ys + i, box));
+    }
+    if (i < node->count)
+        count += count_set_bits(rect_match_scalar(xs + i, ys + i, node->count - i, box));
+    return count;
+}
+
+static size_t count_leaf_in_circle(const QuadTree* tree, const QuadTreeNode* node, const Circle* circle) {
+    STATS_COUNT_POINTS(node->count);
+    const float* xs = leaf_xs(tree, node);
+    const float* ys = leaf_ys(tree, node);
+    size_t count = 0;
+    uint32_t i = 0;
+    for (; i + LEAF_LANES <= node->count; i += LEAF_LANES) {
+        count += count_set_bits(circle_match(xs + i, ys + i, circle));
+    }
+    if (i < node->count)
+        count += count_set_bits(circle_match_scalar(xs + i, ys + i, node->count - i, circle));
+    return count;
+}
+
+size_t quad_tree_count_in_rect(const QuadTree* tree, Rect range) {
+    assert(tree != NULL);
+    if (!rects_intersect(tree->nodes[0].bounds, range))
+        return 0;
+
+    QueryBox box = query_box_from_rect(range);
+    size_t count = 0;
+
+    NodeStack stack;
+    initialize_node_stack(&stack);
+    push_node(&stack, 0);
+
+    while (stack.count > 0) {
+        const QuadTreeNode* node = &tree->nodes[pop_node(&stack)];
+        STATS_COUNT_NODES(1);
+        if (node->count == 0)
+            continue;
+        if (is_rect_inside_box(node->bounds, &box)) {
+            count += node->count;
+            continue;
+        }
+        if (is_leaf_node(node)) {
+            count += count_leaf_in_rect(tree, node, &box);
+            continue;
+        }
+
+        float cx = node->bounds.center.x;
+        float cy = node->bounds.center.y;
+        bool west = box.min_x < cx;
+        bool east = box.max_x >= cx;
+        bool north = box.min_y <= cy;
+        bool south = box.max_y > cy;
+        if (south && west)
+            push_node(&stack, node->first_child + QUAD_TREE_INDEX_SW);
+        if (south && east)
+            push_node(&stack, node->first_child + QUAD_TREE_INDEX_SE);
+        if (north && west)
+            push_node(&stack, node->first_child + QUAD_TREE_INDEX_NW);
+        if (north && east)
+            push_node(&stack, node->first_child + QUAD_TREE_INDEX_NE);
+    }
+    destroy_node_stack(&stack);
+    return count;
+}
+
+size_t quad_tree_count_in_circle(const QuadTree* tree, Circle range) {
+    assert(tree != NULL);
+    size_t count = 0;
+
+    NodeStack stack;
+    initialize_node_stack(&stack);
+    push_node(&stack, 0);
+
+    while (stack.count > 0) {
+        const QuadTreeNode* node = &tree->nodes[pop_node(&stack)];
+        STATS_COUNT_NODES(1);
+        if (node->count == 0 || !circle_rect_intersect(range, node->bounds))
+            continue;
+        if (is_rect_inside_circle(node->bounds, range)) {
+            count += node->count;
+            continue;
+        }
+        if (is_leaf_node(node)) {
+            count += count_leaf_in_circle(tree, node, &range);
+            continue;
+        }
+        push_children(&stack, node->first_child);
+    }
+    destroy_node_stack(&stack);
+    return count;
+}
+
+static uint32_t* cursor_stack(QuadTreeCursor* cursor) {
+    return cursor->spilled_stack != NULL ? cursor->spilled_stack : cursor->inline_stack;
+}
+
+static void push_cursor_node(QuadTreeCursor* cursor, uint32_t node_index, bool inside) {
+    assert((node_index & CURSOR_INSIDE_FLAG) == 0);
+    if (cursor->stack_count == cursor->stack_capacity) {
+        uint32_t* items = (uint32_t*)malloc(cursor->stack_capacity * 2 * sizeof(uint32_t));
+        assert(items != NULL);
+        memcpy(items, cursor_stack(cursor), cursor->stack_count * sizeof(uint32_t));
+        free(cursor->spilled_stack);
+        cursor->spilled_stack = items;
+        cursor->stack_capacity *= 2;
+    }
+    cursor_stack(cursor)[cursor->stack_count++] = inside ? node_index | CURSOR_INSIDE_FLAG : node_index;
+}
+
+static void initialize_quad_tree_cursor(QuadTreeCursor* cursor, const QuadTree* tree, QuadTreeQueryShape shape) {
+    assert(cursor != NULL && tree != NULL);
+    memset(cursor, 0, sizeof(QuadTreeCursor));
+    cursor->tree = tree;
+    cursor->shape = shape;
+    cursor->leaf = QUAD_TREE_NULL_NODE;
+    cursor->stack_capacity = QUAD_TREE_CURSOR_INLINE_DEPTH;
+}
+
+void initialize_quad_tree_rect_cursor(QuadTreeCursor* cursor, const QuadTree* tree, Rect range) {
+    initialize_quad_tree_cursor(cursor, tree, QUAD_TREE_QUERY_RECT);
+    cursor->rect = range;
+    if (rects_intersect(tree->nodes[0].bounds, range))
+        push_cursor_node(cursor, 0, false);
+}
+
+void initialize_quad_tree_circle_cursor(QuadTreeCursor* cursor, const QuadTree* tree, Circle range) {
+    initialize_quad_tree_cursor(cursor, tree, QUAD_TREE_QUERY_CIRCLE);
+    cursor->circle = range;
+    push_cursor_node(cursor, 0, false);
+}
+
+void destroy_quad_tree_cursor(QuadTreeCursor* cursor) {
+    free(cursor->spilled_stack);
+    memset(cursor, 0, sizeof(QuadTreeCursor));
+    cursor->leaf = QUAD_TREE_NULL_NODE;
+}
+
+// Reads matches from the current leaf until it runs out or out is full. A
+// step that fills out mid-way resumes at the first match it did not write.
+// out_ids may be NULL.
+static size_t read_cursor_leaf(QuadTreeCursor* cursor, const QueryBox* box, Point* out, uint64_t* out_ids, size_t max_count) {
+    const QuadTreeNode* node = &cursor->tree->nodes[cursor->leaf];
+    const float* xs = leaf_xs(cursor->tree, node);
+    const float* ys = leaf_ys(cursor->tree, node);
+    const uint64_t* ids = leaf_ids(cursor->tree, node);
+    uint32_t position = cursor->leaf_position;
+    size_t count = 0;
+
+    if (cursor->leaf_inside) {
+        for (; position < node->count && count < max_count; position++) {
+            if (out_ids != NULL)
+                out_ids[count] = ids[position];
+            out[count++] = (Point){.x = xs[position], .y = ys[position]};
+        }
+    }
+
+    while (position < node->count && count < max_count) {
+        uint32_t lanes = node->count - position < LEAF_LANES ? node->count - position : LEAF_LANES;
+        uint32_t mask;
+        if (cursor->shape == QUAD_TREE_QUERY_RECT)
+            mask = lanes == LEAF_LANES ? rect_match(xs + position, ys + position, box) : rect_match_scalar(xs + position, ys + position, lanes, box);
+        else
+            mask = lanes == LEAF_LANES ? circle_match(xs + position, ys + position, &cursor->circle) : circle_match_scalar(xs + position, ys + position, lanes, &cursor->circle);
+
+        while (mask != 0 && count < max_count) {
+            unsigned lane = lowest_set_bit(mask);
+            if (out_ids != NULL)
+                out_ids[count] = ids[position + lane];
+            out[count++] = (Point){.x = xs[position + lane], .y = ys[position + lane]};
+            mask &= mask - 1;
+        }
+        position += mask != 0 ? lowest_set_bit(mask) : lanes;
+    }
+
+    STATS_COUNT_POINTS(position - cursor->leaf_position);
+    cursor->leaf_position = position;
+    if (position == node->count)
+        cursor->leaf = QUAD_TREE_NULL_NODE;
+    return count;
+}
+
+size_t quad_tree_cursor_next(QuadTreeCursor* cursor, Point* out, size_t max_count) {
+    return quad_tree_cursor_next_with_ids(cursor, out, NULL, max_count);
+}
+
+size_t quad_tree_cursor_next_with_ids(QuadTreeCursor* cursor, Point* out, uint64_t* ids, size_t max_count) {
+    assert(cursor != NULL && (out != NULL || max_count == 0));
+    if (cursor->tree == NULL)
+        return 0;
+
+    const QuadTree* tree = cursor->tree;
+    QueryBox box = query_box_from_rect(cursor->rect);
+    size_t count = 0;
+
+    while (count < max_count) {
+        if (cursor->leaf != QUAD_TREE_NULL_NODE) {
+            count += read_cursor_leaf(cursor, &box, out + count, ids != NULL ? ids + count : NULL, max_count - count);
+            continue;
+        }
+        if (cursor->stack_count == 0)
+            break;
+
+        uint32_t entry = cursor_stack(cursor)[--cursor->stack_count];
+        uint32_t node_index = entry & ~CURSOR_INSIDE_FLAG;
+        bool inside = (entry & CURSOR_INSIDE_FLAG) != 0;
+        const QuadTreeNode* node = &tree->nodes[node_index];
+        STATS_COUNT_NODES(1);
+        if (node->count == 0)
+            continue;
+
+        if (!inside && cursor->shape == QUAD_TREE_QUERY_CIRCLE) {
+            if (!circle_rect_intersect(cursor->circle, node->bounds))
+                continue;
+            inside = is_rect_inside_circle(node->bounds, cursor->circle);
+        }
+        else if (!inside) {
+            inside = is_rect_inside_box(node->bounds, &box);
+        }
+
+        if (is_leaf_node(node)) {
+            cursor->leaf = node_index;
+            cursor->leaf_position = 0;
+            cursor->leaf_inside = inside;
+            continue;
+        }
+
+        // Pushed in reverse so that results come out in the same order as
+        // search_space_in_tree and search_circle_in_tree.
+        if (inside || cursor->shape == QUAD_TREE_QUERY_CIRCLE) {
+            for (uint32_t i = QUAD_TREE_MAX_CHILDREN; i > 0; i--) {
+                push_cursor_node(cursor, node->first_child + i - 1, inside);
+            }
+            continue;
+        }
+
+        float cx = node->bounds.center.x;
+        float cy = node->bounds.center.y;
+        bool west = box.min_x < cx;
+        bool east = box.max_x >= cx;
+        bool north = box.min_y <= cy;
+        bool south = box.max_y > cy;
+        if (south && west)
+            push_cursor_node(cursor, node->first_child + QUAD_TREE_INDEX_SW, false);
+        if (south && east)
+            push_cursor_node(cursor, node->first_child + QUAD_TREE_INDEX_SE, false);
+        if (north && west)
+            push_cursor_node(cursor, node->first_child + QUAD_TREE_INDEX_NW, false);
+        if (north && east)
+            push_cursor_node(cursor, node->first_child + QUAD_TREE_INDEX_NE, false);
+    }
+    return count;
+}
+
+// Feeds the cursor's results to the visitor a chunk at a time. A visitor
+// that stops early leaves at most the rest of one chunk unused.
+static bool visit_cursor(QuadTreeCursor* cursor, QuadTreeVisitor visitor, void* context) {
+    Point chunk[VISIT_CHUNK_SIZE];
+    uint64_t chunk_ids[VISIT_CHUNK_SIZE];
+    bool completed = true;
+    size_t count;
+    while (completed && (count = quad_tree_cursor_next_with_ids(cursor, chunk, chunk_ids, VISIT_CHUNK_SIZE)) > 0) {
+        for (size_t i = 0; i < count && completed; i++) {
+            completed = visitor(chunk[i], chunk_ids[i], context);
+        }
+    }
+    destroy_quad_tree_cursor(cursor);
+    return completed;
+}
+
+bool quad_tree_query_rect_each(const QuadTree* tree, Rect range, QuadTreeVisitor visitor, void* context) {
+    assert(visitor != NULL);
+    QuadTreeCursor cursor;
+    initialize_quad_tree_rect_cursor(&cursor, tree, range);
+    return visit_cursor(&cursor, visitor, context);
+}
+
+bool quad_tree_query_circle_each(const QuadTree* tree, Circle range, QuadTreeVisitor visitor, void* context) {
+    assert(visitor != NULL);
+    QuadTreeCursor cursor;
+    initialize_quad_tree_circle_cursor(&cursor, tree, range);
+    return visit_cursor(&cursor, visitor, context);
+}
+
+// Queries not yet claimed from one worker's share of a batch. The owner and
+// any thief claim chunks from the front, so a single counter is enough.
+typedef struct BatchQueue {
+    atomic_size_t next;
+    size_t end;
+} BatchQueue;
+
+typedef struct BatchBuffer {
+    Point* points;
+    size_t count;
+    size_t capacity;
+} BatchBuffer;
+
+typedef struct BatchContext {
+    const QuadTree* tree;
+    const QuadTreeQuery* queries;
+    QuadTreeResultSpan* spans;
+    // Where each query's points start, and in which worker's buffer. Spans
+    // only get their pointers once every buffer has stopped growing.
+    size_t* offsets;
+    size_t* owners;
+    BatchQueue* queues;
+    size_t thread_count;
+} BatchContext;
+
+typedef struct BatchWorker {
+    BatchContext* context;
+    size_t thread_index;
+    BatchBuffer buffer;
+} BatchWorker;
+
+static size_t available_thread_count() {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (size_t)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1;
+#endif
+}
+
+static bool claim_batch_chunk(BatchQueue* queue, size_t* begin, size_t* end) {
+    if (atomic_load_explicit(&queue->next, memory_order_relaxed) >= queue->end)
+        return false;
+    *begin = atomic_fetch_add(&queue->next, BATCH_CHUNK_SIZE);
+    if (*begin >= queue->end)
+        return false;
+    *end = *begin + BATCH_CHUNK_SIZE < queue->end ? *begin + BATCH_CHUNK_SIZE : queue->end;
+    return true;
+}
+
+// One walk per query, with the cursor writing straight into the free end of
+// the worker's buffer and the buffer doubling whenever the cursor fills it.
+// Only the offset is kept, since the buffer may still move as it grows.
+static void run_batch_query(BatchContext* context, size_t thread_index, BatchBuffer* buffer, size_t query_index) {
+    const QuadTreeQuery* query = &context->queries[query_index];
+    QuadTreeCursor cursor;
+    if (query->shape == QUAD_TREE_QUERY_RECT)
+        initialize_quad_tree_rect_cursor(&cursor, context->tree, query->rect);
+    else
+        initialize_quad_tree_circle_cursor(&cursor, context->tree, query->circle);
+
+    size_t offset = buffer->count;
+    for (;;) {
+        if (buffer->count == buffer->capacity) {
+            size_t capacity = buffer->capacity > 0 ? buffer->capacity * 2 : BATCH_BUFFER_CAPACITY;
+            Point* points = (Point*)realloc(buffer->points, capacity * sizeof(Point));
+            assert(points != NULL);
+            buffer->points = points;
+            buffer->capacity = capacity;
+        }
+        size_t found_count = quad_tree_cursor_next(&cursor, buffer->points + buffer->count, buffer->capacity - buffer->count);
+        if (found_count == 0)
+            break;
+        buffer->count += found_count;
+    }
+    destroy_quad_tree_cursor(&cursor);
+
+    context->offsets[query_index] = offset;
+    context->owners[query_index] = thread_index;
+    context->spans[query_index].count = buffer->count - offset;
+}
+
+// Drains the worker's own queue, then steals from the others, starting with
+// its neighbour so that thieves spread out.
+static int run_batch_worker(void* arg) {
+    BatchWorker* worker = (BatchWorker*)arg;
+    BatchContext* context = worker->context;
+    // Kept local while running, since the workers sit next to each other.
+    BatchBuffer buffer = worker->buffer;
+
+    for (size_t i = 0; i < context->thread_count; i++) {
+        BatchQueue* queue = &context->queues[(worker->thread_index + i) % context->thread_count];
+        size_t begin, end;
+        while (claim_batch_chunk(queue, &begin, &end)) {
+            for (size_t query_index = begin; query_index < end; query_index++) {
+                run_batch_query(context, worker->thread_index, &buffer, query_index);
+            }
+        }
+    }
+    worker->buffer = buffer;
+    return 0;
+}
+
+bool quad_tree_query_batch(const QuadTree* tree, const QuadTreeQuery* queries, size_t count, QuadTreeBatchResults* results, size_t thread_count) {
+    assert(tree != NULL && results != NULL);
+    assert(queries != NULL || count == 0);
+
+    memset(results, 0, sizeof(QuadTreeBatchResults));
+    if (!tree->frozen)
+        return false;
+    if (count == 0)
+        return true;
+
+    if (thread_count == 0)
+        thread_count = available_thread_count();
+    if (thread_count > count / BATCH_QUERIES_PER_THREAD)
+        thread_count = count / BATCH_QUERIES_PER_THREAD;
+    if (thread_count == 0)
+        thread_count = 1;
+
+    BatchContext context = {
+        .tree = tree,
+        .queries = queries,
+        .spans = (QuadTreeResultSpan*)malloc(count * sizeof(QuadTreeResultSpan)),
+        .offsets = (size_t*)malloc(count * sizeof(size_t)),
+        .owners = (size_t*)malloc(count * sizeof(size_t)),
+        .queues = (BatchQueue*)calloc(thread_count, sizeof(BatchQueue)),
+        .thread_count = thread_count,
+    };
+    BatchWorker* workers = (BatchWorker*)calloc(thread_count, sizeof(BatchWorker));
+    thrd_t* threads = (thrd_t*)calloc(thread_count, sizeof(thrd_t));
+    bool* started = (bool*)calloc(thread_count, sizeof(bool));
+    assert(context.spans != NULL && context.offsets != NULL && context.owners != NULL && context.queues != NULL);
+    assert(workers != NULL && threads != NULL && started != NULL);
+
+    for (size_t i = 0; i < thread_count; i++) {
+        atomic_init(&context.queues[i].next, count * i / thread_count);
+        context.queues[i].end = count * (i + 1) / thread_count;
+        workers[i] = (BatchWorker){.context = &context, .thread_index = i};
+    }
+
+    // The calling thread is worker zero. A worker whose thread cannot be
+    // started leaves its queue to be stolen by the others.
+    for (size_t i = 1; i < thread_count; i++) {
+        started[i] = thrd_create(&threads[i], run_batch_worker, &workers[i]) == thrd_success;
+    }
+    run_batch_worker(&workers[0]);
+    for (size_t i = 1; i < thread_count; i++) {
+        if (started[i])
+            thrd_join(threads[i], NULL);
+    }
+
+    results->spans = context.spans;
+    results->span_count = count;
+    results->buffers = (Point**)malloc(thread_count * sizeof(Point*));
+    results->buffer_count = thread_count;
+    assert(results->buffers != NULL);
+    for (size_t i = 0; i < thread_count; i++) {
+        results->buffers[i] = workers[i].buffer.points;
+    }
+    for (size_t i = 0; i < count; i++) {
+        QuadTreeResultSpan* span = &results->spans[i];
+        span->points = span->count > 0 ? results->buffers[context.owners[i]] + context.offsets[i] : NULL;
+    }
+
+    free(started);
+    free(threads);
+    free(workers);
+    free(context.queues);
+    free(context.owners);
+    free(context.offsets);
+    return true;
+}
+
+void destroy_quad_tree_batch_results(QuadTreeBatchResults* results) {
+    assert(results != NULL);
+    for (size_t i = 0; i < results->buffer_count; i++) {
+        free(results->buffers[i]);
+    }
+    free(results->buffers);
+    free(results->spans);
+    memset(results, 0, sizeof(QuadTreeBatchResults));
+}
+
+// Distance joins walk pairs of nodes. A within task pairs a subtree of the
+// first tree with itself; a between task pairs a subtree of the first tree
+// with a disjoint subtree of the second, which is the same tree for a
+// self-join.
+typedef enum JoinTaskKind {
+    JOIN_TASK_WITHIN,
+    JOIN_TASK_BETWEEN,
+} JoinTaskKind;
+
+typedef struct JoinTask {
+    JoinTaskKind kind;
+    uint32_t a;
+    uint32_t b;
+} JoinTask;
+
+typedef struct JoinTaskList {
+    JoinTask* items;
+    size_t count;
+    size_t capacity;
+} JoinTaskList;
+
+typedef struct JoinContext {
+    const QuadTree* a;
+    const QuadTree* b;
+    float radius;
+    QuadTreePairVisitor visitor;
+    void* visitor_context;
+    atomic_bool stopped;
+    // Top-level tasks handed out to the threads of a parallel join.
+    const JoinTask* tasks;
+    size_t task_count;
+    atomic_size_t next_task;
+} JoinContext;
+
+static void push_join_task(JoinTaskList* list, JoinTaskKind kind, uint32_t a, uint32_t b) {
+    if (list->count == list->capacity)
+        increase_list_capacity((void**)&list->items, &list->capacity, sizeof(JoinTask), list->capacity > 0 ? list->capacity : NODE_STACK_INLINE_CAPACITY);
+    list->items[list->count++] = (JoinTask){.kind = kind, .a = a, .b = b};
+}
+
+static float squared_distance_between_rects(Rect a, Rect b) {
+    float dist_x = fmaxf(fabsf(a.center.x - b.center.x) - (a.half_width + b.half_width), 0.0f);
+    float dist_y = fmaxf(fabsf(a.center.y - b.center.y) - (a.half_height + b.half_height), 0.0f);
+    return dist_x * dist_x + dist_y * dist_y;
+}
+
+static bool is_join_task_empty(const JoinContext* context, JoinTask task) {
+    const QuadTreeNode* a = &context->a->nodes[task.a];
+    if (task.kind == JOIN_TASK_WITHIN)
+        return a->count < 2;
+    const QuadTreeNode* b = &context->b->nodes[task.b];
+    return a->count == 0 || b->count == 0 || squared_distance_between_rects(a->bounds, b->bounds) > context->radius * context->radius;
+}
+
+static bool is_join_task_leaf(const JoinContext* context, JoinTask task) {
+    if (!is_leaf_node(&context->a->nodes[task.a]))
+        return false;
+    return task.kind == JOIN_TASK_WITHIN || is_leaf_node(&context->b->nodes[task.b]);
+}
+
+// Points live in leaves only, so splitting a task never reports anything
+// itself. Between tasks split the larger side, or the only side left with
+// children.
+static void push_join_children(const JoinContext* context, JoinTask task, JoinTaskList* list) {
+    const QuadTreeNode* a = &context->a->nodes[task.a];
+    if (task.kind == JOIN_TASK_WITHIN) {
+        for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+            push_join_task(list, JOIN_TASK_WITHIN, a->first_child + i, a->first_child + i);
+            for (uint32_t j = i + 1; j < QUAD_TREE_MAX_CHILDREN; j++) {
+                push_join_task(list, JOIN_TASK_BETWEEN, a->first_child + i, a->first_child + j);
+            }
+        }
+        return;
+    }
+
+    const QuadTreeNode* b = &context->b->nodes[task.b];
+    bool split_a = is_leaf_node(b) || (!is_leaf_node(a) && a->bounds.half_width + a->bounds.half_height >= b->bounds.half_width + b->bounds.half_height);
+    for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+        if (split_a)
+            push_join_task(list, JOIN_TASK_BETWEEN, a->first_child + i, task.b);
+        else
+            push_join_task(list, JOIN_TASK_BETWEEN, task.a, b->first_child + i);
+    }
+}
+
+// Reports point against the points of a leaf from begin on, using the same
+// circle kernel as the circle queries.
+static bool visit_leaf_points_within(const JoinContext* context, Point point, uint64_t id, const QuadTree* tree, const QuadTreeNode* leaf, uint32_t begin) {
+    const float* xs = leaf_xs(tree, leaf);
+    const float* ys = leaf_ys(tree, leaf);
+    const uint64_t* ids = leaf_ids(tree, leaf);
+    Circle circle = {.center = point, .radius = context->radius};
+
+    uint32_t i = begin;
+    for (;;) {
+        uint32_t remaining = leaf->count - i;
+        if (remaining == 0)
+            return true;
+        uint32_t step = remaining < LEAF_LANES ? remaining : LEAF_LANES;
+        uint32_t mask = step == LEAF_LANES ? circle_match(xs + i, ys + i, &circle) : circle_match_scalar(xs + i, ys + i, step, &circle);
+        for (; mask != 0; mask &= mask - 1) {
+            uint32_t other = i + lowest_set_bit(mask);
+            if (!context->visitor(point, id, (Point){.x = xs[other], .y = ys[other]}, ids[other], context->visitor_context))
+                return false;
+        }
+        i += step;
+    }
+}
+
+static bool visit_join_leaves(const JoinContext* context, JoinTask task) {
+    const QuadTreeNode* a = &context->a->nodes[task.a];
+    const QuadTreeNode* b = &context->b->nodes[task.b];
+    for (uint32_t i = 0; i < a->count; i++) {
+        Point point = leaf_point(context->a, a, i);
+        uint64_t id = leaf_ids(context->a, a)[i];
+        uint32_t begin = task.kind == JOIN_TASK_WITHIN ? i + 1 : 0;
+        if (!visit_leaf_points_within(context, point, id, context->b, b, begin))
+            return false;
+    }
+    return true;
+}
+
+static bool run_join_tasks(JoinContext* context, JoinTaskList* stack) {
+    while (stack->count > 0) {
+        if (atomic_load_explicit(&context->stopped, memory_order_relaxed))
+            return false;
+
+        JoinTask task = stack->items[--stack->count];
+        if (is_join_task_empty(context, task))
+            continue;
+        if (!is_join_task_leaf(context, task)) {
+            push_join_children(context, task, stack);
+            continue;
+        }
+        if (!visit_join_leaves(context, task)) {
+            atomic_store(&context->stopped, true);
+            return false;
+        }
+    }
+    return true;
+}
+
+static int run_join_worker(void* arg) {
+    JoinContext* context = (JoinContext*)arg;
+    JoinTaskList stack = {0};
+    for (;;) {
+        size_t task_index = atomic_fetch_add(&context->next_task, 1);
+        if (task_index >= context->task_count)
+            break;
+        push_join_task(&stack, context->tasks[task_index].kind, context->tasks[task_index].a, context->tasks[task_index].b);
+        if (!run_join_tasks(context, &stack))
+            break;
+    }
+    free(stack.items);
+    return 0;
+}
+
+static bool run_join(const QuadTree* a, const QuadTree* b, float radius, QuadTreePairVisitor visitor, void* context, JoinTaskKind root_kind) {
+    assert(visitor != NULL && radius >= 0.0f);
+
+    JoinContext join = {.a = a, .b = b, .radius = radius, .visitor = visitor, .visitor_context = context};
+    atomic_init(&join.stopped, false);
+    JoinTaskList stack = {0};
+    push_join_task(&stack, root_kind, 0, 0);
+    bool completed = run_join_tasks(&join, &stack);
+    free(stack.items);
+    return completed;
+}
+
+// Splits the top levels breadth-first until every thread has several tasks
+// to claim, so that uneven subtrees still balance out.
+static bool run_join_parallel(const QuadTree* a, const QuadTree* b, float radius, QuadTreePairVisitor visitor, void* context, JoinTaskKind root_kind, size_t thread_count) {
+    assert(visitor != NULL && radius >= 0.0f);
+    assert(a->frozen && b->frozen);
+
+    JoinContext join = {.a = a, .b = b, .radius = radius, .visitor = visitor, .visitor_context = context};
+    atomic_init(&join.stopped, false);
+    atomic_init(&join.next_task, 0);
+    if (thread_count == 0)
+        thread_count = available_thread_count();
+
+    JoinTaskList tasks = {0};
+    JoinTaskList next = {0};
+    push_join_task(&tasks, root_kind, 0, 0);
+    bool expanded = true;
+    while (expanded && tasks.count < thread_count * JOIN_TASKS_PER_THREAD) {
+        expanded = false;
+        next.count = 0;
+        for (size_t i = 0; i < tasks.count; i++) {
+            JoinTask task = tasks.items[i];
+            if (is_join_task_empty(&join, task))
+                continue;
+            if (is_join_task_leaf(&join, task)) {
+                push_join_task(&next, task.kind, task.a, task.b);
+                continue;
+            }
+            push_join_children(&join, task, &next);
+            expanded = true;
+        }
+        JoinTaskList swapped = tasks;
+        tasks = next;
+        next = swapped;
+    }
+    join.tasks = tasks.items;
+    join.task_count = tasks.count;
+    if (thread_count > tasks.count)
+        thread_count = tasks.count > 0 ? tasks.count : 1;
+
+    // The calling thread works too. Tasks of a thread that cannot be
+    // started are simply claimed by the others.
+    thrd_t* threads = (thrd_t*)calloc(thread_count, sizeof(thrd_t));
+    bool* started = (bool*)calloc(thread_count, sizeof(bool));
+    assert(threads != NULL && started != NULL);
+    for (size_t i = 1; i < thread_count; i++) {
+        started[i] = thrd_create(&threads[i], run_join_worker, &join) == thrd_success;
+    }
+    run_join_worker(&join);
+    for (size_t i = 1; i < thread_count; i++) {
+        if (started[i])
+            thrd_join(threads[i], NULL);
+    }
+
+    free(started);
+    free(threads);
+    free(next.items);
+    free(tasks.items);
+    return !atomic_load(&join.stopped);
+}
+
+bool quad_tree_pairs_within(const QuadTree* tree, float radius, QuadTreePairVisitor visitor, void* context) {
+    assert(tree != NULL);
+    return run_join(tree, tree, radius, visitor, context, JOIN_TASK_WITHIN);
+}
+
+bool quad_tree_join_within(const QuadTree* a, const QuadTree* b, float radius, QuadTreePairVisitor visitor, void* context) {
+    assert(a != NULL && b != NULL);
+    return run_join(a, b, radius, visitor, context, JOIN_TASK_BETWEEN);
+}
+
+bool quad_tree_pairs_within_parallel(const QuadTree* tree, float radius, QuadTreePairVisitor visitor, void* context, size_t thread_count) {
+    assert(tree != NULL);
+    return run_join_parallel(tree, tree, radius, visitor, context, JOIN_TASK_WITHIN, thread_count);
+}
+
+bool quad_tree_join_within_parallel(const QuadTree* a, const QuadTree* b, float radius, QuadTreePairVisitor visitor, void* context, size_t thread_count) {
+    assert(a != NULL && b != NULL);
+    return run_join_parallel(a, b, radius, visitor, context, JOIN_TASK_BETWEEN, thread_count);
+}
+
+int quad_tree_knn(const QuadTree* tree, Point point, int k, Point* out) {
+    assert(tree != NULL);
+    assert(out != NULL || k <= 0);
+    if (k <= 0 || tree->nodes[0].count == 0)
+        return 0;
+
+    MinHeap nodes = {0};
+    MinHeap best = {0};
+    increase_list_capacity((void**)&best.items, &best.capacity, sizeof(HeapEntry), (size_t)k);
+    heap_push(&nodes, (HeapEntry){.key = squared_distance_to_rect(tree->nodes[0].bounds, point), .node_index = 0});
+
+    // Nodes come off the queue closest first, so once the closest remaining
+    // node is further away than the k-th best point, nothing left can help.
+    while (nodes.count > 0) {
+        HeapEntry entry = heap_pop(&nodes);
+        bool is_full = best.count == (size_t)k;
+        if (is_full && entry.key > -best.items[0].key)
+            break;
+
+        const QuadTreeNode* node = &tree->nodes[entry.node_index];
+        STATS_COUNT_NODES(1);
+        if (is_leaf_node(node)) {
+            STATS_COUNT_POINTS(node->count);
+            for (uint32_t i = 0; i < node->count; i++) {
+                Point candidate = leaf_point(tree, node, i);
+                float distance = squared_distance(point, candidate);
+                if (best.count == (size_t)k) {
+                    if (distance >= -best.items[0].key)
+                        continue;
+                    heap_pop(&best);
+                }
+                heap_push(&best, (HeapEntry){.key = -distance, .point = candidate});
+            }
+            continue;
+        }
+
+        for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+            const QuadTreeNode* child = &tree->nodes[node->first_child + i];
+            if (child->count == 0)
+                continue;
+
+            float distance = squared_distance_to_rect(child->bounds, point);
+            if (best.count < (size_t)k || distance < -best.items[0].key)
+                heap_push(&nodes, (HeapEntry){.key = distance, .node_index = node->first_child + i});
+        }
+    }
+
+    // The heap yields the furthest point first; fill the output from the back
+    // so it ends up closest first.
+    int found_count = (int)best.count;
+    for (int i = found_count - 1; i >= 0; i--) {
+        out[i] = heap_pop(&best).point;
+    }
+
+    free(best.items);
+    free(nodes.items);
+    return found_count;
+}
+
+bool quad_tree_nearest(const QuadTree* tree, Point point, Point* nearest) {
+    return quad_tree_knn(tree, point, 1, nearest) == 1;
+}
+
+// Depths ride along in a second stack, as in print_quad_tree.
+void quad_tree_get_stats(const QuadTree* tree, QuadTreeStats* stats) {
+    assert(tree != NULL && stats != NULL);
+    memset(stats, 0, sizeof(QuadTreeStats));
+
+    NodeStack stack;
+    NodeStack depths;
+    initialize_node_stack(&stack);
+    initialize_node_stack(&depths);
+    push_node(&stack, 0);
+    push_node(&depths, 0);
+
+    size_t bucket_slots = 0;
+    while (stack.count > 0) {
+        const QuadTreeNode* node = &tree->nodes[pop_node(&stack)];
+        uint32_t depth = pop_node(&depths);
+        ++stats->node_count;
+        ++stats->depth_histogram[depth < QUAD_TREE_DEPTH_HISTOGRAM_BUCKETS ? depth : QUAD_TREE_DEPTH_HISTOGRAM_BUCKETS - 1];
+        if (depth > stats->max_depth)
+            stats->max_depth = depth;
+
+        if (!is_leaf_node(node)) {
+            push_children(&stack, node->first_child);
+            for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+                push_node(&depths, depth + 1);
+            }
+            continue;
+        }
+
+        ++stats->leaf_count;
+        if (node->count == 0) {
+            ++stats->empty_leaf_count;
+            continue;
+        }
+        if (node->count > tree->leaf_capacity)
+            ++stats->overflow_leaf_count;
+        bucket_slots += (size_t)leaf_bucket_run(tree, node->count) * tree->leaf_capacity;
+    }
+    destroy_node_stack(&depths);
+    destroy_node_stack(&stack);
+
+    stats->point_count = tree->nodes[0].count;
+    stats->leaf_fill_factor = bucket_slots > 0 ? (double)stats->point_count / (double)bucket_slots : 0.0;
+    if (tree->mapping.data != NULL) {
+        stats->memory_bytes = sizeof(QuadTree) + tree->mapping.size;
+        return;
+    }
+
+    size_t id_slot_size = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint8_t);
+    stats->memory_bytes = sizeof(QuadTree)
+                          + tree->node_capacity * sizeof(QuadTreeNode)
+                          + tree->bucket_capacity * (tree->leaf_capacity * (2 * sizeof(float) + sizeof(uint64_t)) + sizeof(uint32_t))
+                          + (tree->id_slots.slots.capacity + tree->id_slots.old_slots.capacity) * id_slot_size;
+}
+
+void quad_tree_reset_query_metrics(void) {
+#if defined(QUAD_TREE_ENABLE_STATS)
+    memset(&query_metrics, 0, sizeof(QuadTreeQueryMetrics));
+#endif
+}
+
+void quad_tree_get_query_metrics(QuadTreeQueryMetrics* metrics) {
+    assert(metrics != NULL);
+#if defined(QUAD_TREE_ENABLE_STATS)
+    *metrics = query_metrics;
+#else
+    memset(metrics, 0, sizeof(QuadTreeQueryMetrics));
+#endif
+}
+
+void print_quad_tree(const QuadTree* tree, int level) {
+    if (tree == NULL) return;
+
+    // Depths ride along in a second stack so the output keeps its indentation.
+    NodeStack stack;
+    NodeStack levels;
+    initialize_node_stack(&stack);
+    initialize_node_stack(&levels);
+    push_node(&stack, 0);
+    push_node(&levels, (uint32_t)level);
+
+    while (stack.count > 0) {
+        const QuadTreeNode* node = &tree->nodes[pop_node(&stack)];
+        int node_level = (int)pop_node(&levels);
+        for (int i = 0; i < node_level; i++) {
+            fprintf(stderr, "  ");
+        }
+
+        fprintf(stderr, "Node at (%.2f, %.2f), half_w=%.2f, half_h=%.2f, leaf=%d, count=%d\n", node->bounds.center.x, node->bounds.center.y, node->bounds.half_width, node->bounds.half_height, is_leaf_node(node), node->count);
+
+        if (is_leaf_node(node)) {
+            for (uint32_t i = 0; i < node->count; i++) {
+                for (int j = 0; j < node_level + 1; j++) {
+                    fprintf(stderr, "  ");
+                }
+                fprintf(stderr, "Point: (%.2f, %.2f)\n", leaf_xs(tree, node)[i], leaf_ys(tree, node)[i]);
+            }
+        }
+        else {
+            push_children(&stack, node->first_child);
+            for (uint32_t i = 0; i < QUAD_TREE_MAX_CHILDREN; i++) {
+                push_node(&levels, (uint32_t)node_level + 1);
+            }
+        }
+    }
+    destroy_node_stack(&levels);
+    destroy_node_stack(&stack);
+}
+
+bool remove_point_from_quad_tree(QuadTree* tree, Point point) {
+    assert(tree != NULL);
+    if (tree->frozen)
+        return false;
+
+    uint32_t leaf_index = is_point_inside_rect(tree->nodes[0].bounds, point) ? find_leaf(tree, point) : QUAD_TREE_NULL_NODE;
+    int point_index = leaf_index != QUAD_TREE_NULL_NODE ? find_point_in_leaf(tree, &tree->nodes[leaf_index], point) : -1;
+    if (point_index < 0) {
+        QUAD_TREE_LOG("Point %.2f, %.2f is not in the tree", point.x, point.y);
+        return false;
+    }
+
+    uint64_t id = leaf_ids(tree, &tree->nodes[leaf_index])[point_index];
+    if (id != QUAD_TREE_NO_ID)
+        hash_table_delete_entry(&tree->id_slots, id);
+    remove_point_from_leaf(tree, &tree->nodes[leaf_index], (uint32_t)point_index);
+
+    // Walk down again, fixing counts. The highest node that now fits in a
+    // single leaf absorbs its whole subtree, which covers every node below.
+    uint32_t node_index = 0;
+    while (node_index != leaf_index) {
+        QuadTreeNode* node = &tree->nodes[node_index];
+        --node->count;
+        if (node->count <= tree->leaf_capacity) {
+            QUAD_TREE_LOG("Collapsing node %u with %u points", node_index, node->count);
+            collapse_quad_tree_node(tree, node_index);
+            break;
+        }
+        node_index = child_containing(node, point);
+    }
+    return true;
+}
@@ -0,0 +1,67 @@
+#include "rw_lock.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CPU_RELAX() _mm_pause()
+#else
+#define CPU_RELAX() ((void)0)
+#endif
+
+// The high bit marks a writer that holds or is waiting for the lock, the
+// remaining bits count active readers. New readers back off while the bit is
+// set, so a steady stream of readers cannot starve a writer.
+#define RW_LOCK_WRITER      0x80000000u
+#define RW_LOCK_SPIN_LIMIT  64
+
+static void backoff(unsigned* spins) {
+    if (++(*spins) < RW_LOCK_SPIN_LIMIT) {
+        CPU_RELAX();
+    }
+    else {
+        thrd_yield();
+    }
+}
+
+void initialize_rw_lock(RwLock* lock) {
+    assert(lock != NULL);
+    atomic_init(&lock->state, 0);
+}
+
+void rw_lock_acquire_read(RwLock* lock) {
+    unsigned spins = 0;
+    for (;;) {
+        unsigned state = atomic_load_explicit(&lock->state, memory_order_relaxed);
+        if ((state & RW_LOCK_WRITER) == 0 && atomic_compare_exchange_weak_explicit(&lock->state, &state, state + 1, memory_order_acquire, memory_order_relaxed))
+            return;
+        backoff(&spins);
+    }
+}
+
+void rw_lock_release_read(RwLock* lock) {
+    unsigned previous = atomic_fetch_sub_explicit(&lock->state, 1, memory_order_release);
+    assert((previous & ~RW_LOCK_WRITER) > 0);
+    (void)previous;
+}
+
+void rw_lock_acquire_write(RwLock* lock) {
+    unsigned spins = 0;
+    for (;;) {
+        unsigned state = atomic_load_explicit(&lock->state, memory_order_relaxed);
+        if ((state & RW_LOCK_WRITER) == 0 && atomic_compare_exchange_weak_explicit(&lock->state, &state, state | RW_LOCK_WRITER, memory_order_acquire, memory_order_relaxed))
+            break;
+        backoff(&spins);
+    }
+
+    while ((atomic_load_explicit(&lock->state, memory_order_acquire) & ~RW_LOCK_WRITER) != 0) {
+        backoff(&spins);
+    }
+}
+
+void rw_lock_release_write(RwLock* lock) {
+    assert((atomic_load_explicit(&lock->state, memory_order_relaxed) & RW_LOCK_WRITER) != 0);
+    atomic_store_explicit(&lock->state, 0, memory_order_release);
+}